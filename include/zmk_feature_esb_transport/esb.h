@@ -1,6 +1,33 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+/**
+ * @brief Report types carried over ESB, matching the BLESB packet type byte
+ */
+enum zmk_esb_report_type {
+    ZMK_ESB_REPORT_KEYBOARD = 1,
+    ZMK_ESB_REPORT_CONSUMER = 2,
+    ZMK_ESB_REPORT_MOUSE = 3,
+};
+
+#define ZMK_ESB_REPORT_TYPE_COUNT 3
+
+#define ZMK_ESB_CHANNELS_MAX 16
+#define ZMK_ESB_CHANNEL_MAX 100
+
+/**
+ * @brief ESB pipe and retransmit settings for one report type
+ */
+struct zmk_esb_pipe_config {
+    uint8_t pipe;                 // ESB pipe, 0-7
+    uint8_t retransmit_count;     // 0 = fire-and-forget
+    uint16_t retransmit_delay_us; // Delay between retransmits
+};
 
 /**
  * @brief Check if ESB transport is connected and ready
@@ -13,8 +40,402 @@
  */
 bool zmk_esb_active_profile_is_connected(void);
 
-// Future expansion space for:
-// - Profile management functions  
-// - Address configuration functions
-// - Channel selection functions
-// - Connection quality functions
\ No newline at end of file
+/**
+ * @brief Route a report type onto an ESB pipe
+ *
+ * Each pipe keeps its own retransmit settings in BLESB, so a stalled
+ * fire-and-forget mouse pipe never delays a keyboard pipe retransmitting
+ * aggressively. The mapping is pushed to BLESB immediately when connected,
+ * and again each time BLESB confirms ESB mode.
+ *
+ * @return 0 on success, -EINVAL for an unknown type or pipe, negative error
+ *         code if the control message could not be queued
+ */
+int zmk_esb_set_report_pipe(enum zmk_esb_report_type type,
+                            const struct zmk_esb_pipe_config *config);
+
+/**
+ * @brief Get the current ESB pipe routing of a report type
+ *
+ * @return 0 on success, -EINVAL for an unknown type
+ */
+int zmk_esb_get_report_pipe(enum zmk_esb_report_type type, struct zmk_esb_pipe_config *config);
+
+/**
+ * @brief Report rate profiles, from lowest latency down to lowest power
+ */
+enum zmk_esb_report_rate {
+    ZMK_ESB_REPORT_RATE_1KHZ,
+    ZMK_ESB_REPORT_RATE_2KHZ,
+    ZMK_ESB_REPORT_RATE_4KHZ,
+    ZMK_ESB_REPORT_RATE_8KHZ,
+    ZMK_ESB_REPORT_RATE_COUNT,
+};
+
+/**
+ * @brief Switch the report rate of the ESB path
+ *
+ * Sets how often mouse frames leave (motion in between is merged), and tells
+ * BLESB and the dongle the new polling interval. Saved through settings.
+ *
+ * @return 0 on success, -EINVAL for an unknown rate, negative error code if
+ *         BLESB could not be told
+ */
+int zmk_esb_set_report_rate(enum zmk_esb_report_rate rate);
+
+enum zmk_esb_report_rate zmk_esb_get_report_rate(void);
+
+uint16_t zmk_esb_get_report_interval_us(void);
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+struct zmk_esb_pointer_stats {
+    uint32_t merged;              // Mouse reports summed into another report
+    uint32_t expired;             // Mouse frames queued past CONFIG_ZMK_ESB_MOUSE_DEADLINE_US
+};
+
+int zmk_esb_get_pointer_stats(struct zmk_esb_pointer_stats *stats);
+#endif
+
+/**
+ * @brief Transport latency modes
+ */
+enum zmk_esb_latency_mode {
+    ZMK_ESB_LATENCY_PERFORMANCE,  // BLESB radio and UART always ready
+    ZMK_ESB_LATENCY_EFFICIENCY,   // UART and BLESB sleep when idle
+};
+
+/**
+ * @brief Switch the latency mode, saved through settings
+ *
+ * In efficiency mode the UART and BLESB sleep after CONFIG_ZMK_ESB_IDLE_TIMEOUT_MS
+ * without traffic and are woken by the next key press or report.
+ */
+int zmk_esb_set_latency_mode(enum zmk_esb_latency_mode mode);
+
+enum zmk_esb_latency_mode zmk_esb_get_latency_mode(void);
+
+/**
+ * @brief Start waking a sleeping link ahead of a report
+ *
+ * Called on key press already; kscan or sensor drivers may call it earlier,
+ * e.g. from their interrupt handler before debouncing.
+ */
+void zmk_esb_wake(void);
+
+struct zmk_esb_wake_stats {
+    uint32_t wakes;
+    uint32_t last_us;             // Wake strobe to first report handed to the UART
+    uint32_t max_us;
+};
+
+int zmk_esb_get_wake_stats(struct zmk_esb_wake_stats *stats);
+
+/**
+ * @brief UART resume cost under device runtime PM
+ *
+ * Between bursts the UART is released and resumed by the next frame. Once a
+ * resume exceeds CONFIG_ZMK_ESB_UART_RESUME_BUDGET_US the UART is pinned on.
+ */
+struct zmk_esb_resume_stats {
+    uint32_t resumes;
+    uint32_t last_us;             // Resume start to first byte in the UART FIFO
+    uint32_t max_us;
+    bool pinned;
+};
+
+int zmk_esb_get_resume_stats(struct zmk_esb_resume_stats *stats);
+
+/**
+ * @brief Transport counters, summed over all ESB transport instances
+ */
+struct zmk_esb_stats {
+    uint32_t frames;              // HID frames handed to the UART
+    uint32_t tx_bytes;            // UART bytes, control traffic included
+    uint32_t rx_bytes;
+    uint32_t dropped;             // HID frames discarded unsent
+    uint32_t refused;             // Reports refused with -EAGAIN
+    uint32_t retransmits;         // ESB retransmits reported by BLESB
+};
+
+int zmk_esb_get_stats(struct zmk_esb_stats *stats);
+
+/**
+ * @brief Clear the transport, HID, pointer and histogram counters
+ */
+void zmk_esb_reset_stats(void);
+
+/**
+ * @brief Set the RF channels the ESB link may hop between
+ *
+ * With CONFIG_ZMK_ESB_CHANNEL_HOPPING the transport moves away from channels
+ * whose failure rate, as reported by BLESB, exceeds the configured threshold.
+ * BLESB coordinates each hop with the dongle.
+ *
+ * @param channels RF channels, 0-100 (2400 + n MHz); the first is used to start
+ * @param count Number of channels, 1 to ZMK_ESB_CHANNELS_MAX
+ * @return 0 on success, -EINVAL for an invalid list, negative error code if
+ *         the list could not be sent to BLESB
+ */
+int zmk_esb_set_channels(const uint8_t *channels, size_t count);
+
+/**
+ * @brief Get the current RF channel list
+ *
+ * @return Number of channels copied into @p channels, -EINVAL if @p channels
+ * is NULL or @p size is 0
+ */
+int zmk_esb_get_channels(uint8_t *channels, size_t size);
+
+/**
+ * @brief Get the RF channel currently in use
+ */
+uint8_t zmk_esb_get_active_channel(void);
+
+/**
+ * @brief Get the smoothed failure rate of a channel in the list
+ *
+ * @return Failure rate in permille, or -ENOENT if the channel is not in the list
+ */
+int zmk_esb_get_channel_failure_rate(uint8_t channel);
+
+/**
+ * @brief ESB address of a paired dongle
+ */
+struct zmk_esb_address {
+    uint8_t base_addr_0[4];
+    uint8_t base_addr_1[4];
+    uint8_t prefixes[8];
+};
+
+/**
+ * @brief Select a dongle profile
+ *
+ * The profile's address and last-known channel are pushed to BLESB in one
+ * message, and again each time BLESB confirms ESB mode, so reconnecting after
+ * boot or wake takes a single round trip. The selection is persisted.
+ *
+ * @return 0 on success, -EINVAL for an index past CONFIG_ZMK_ESB_PROFILE_COUNT
+ */
+int zmk_esb_prof_select(uint8_t index);
+int zmk_esb_prof_next(void);
+int zmk_esb_prof_prev(void);
+
+/**
+ * @brief Index of the selected dongle profile
+ */
+int zmk_esb_active_profile_index(void);
+
+/**
+ * @brief Check whether the selected profile has no paired dongle
+ */
+bool zmk_esb_active_profile_is_open(void);
+
+/**
+ * @brief Forget the dongle paired to the selected profile
+ */
+int zmk_esb_clear_prof(void);
+
+/**
+ * @brief Ask BLESB to pair the selected profile with a dongle
+ *
+ * The resulting address and channel are stored in the profile once BLESB
+ * reports them.
+ *
+ * @return 0 on success, -ENOTCONN if BLESB has not confirmed ESB mode
+ */
+int zmk_esb_pair(void);
+
+/**
+ * @brief Set or get the dongle address of the selected profile directly
+ */
+int zmk_esb_set_address(const struct zmk_esb_address *address);
+int zmk_esb_get_address(struct zmk_esb_address *address);
+
+/**
+ * @brief Messages that may exceed one ESB payload
+ */
+enum zmk_esb_message_type {
+    ZMK_ESB_MESSAGE_HID_DESCRIPTOR = 0x30,
+    ZMK_ESB_MESSAGE_VENDOR = 0x31,
+};
+
+/**
+ * @brief Send a message of any size to the dongle
+ *
+ * Messages larger than the negotiated ESB payload are fragmented; fragments
+ * are pipelined without waiting for per-fragment acknowledgements. Blocks
+ * until the last fragment is queued.
+ *
+ * @return 0 on success, -ENOTCONN if not connected, -EMSGSIZE if the message
+ *         needs fragmentation that BLESB does not support or more than 255
+ *         fragments
+ */
+int zmk_esb_send_message(enum zmk_esb_message_type type, const uint8_t *data, size_t len);
+
+typedef void (*zmk_esb_message_callback_t)(enum zmk_esb_message_type type, const uint8_t *data,
+                                           size_t len);
+
+/**
+ * @brief Receive messages from the dongle, reassembled when fragmented
+ *
+ * The callback runs on the system workqueue. Messages larger than
+ * CONFIG_ZMK_ESB_REASSEMBLY_SIZE are dropped.
+ */
+void zmk_esb_set_message_callback(zmk_esb_message_callback_t callback);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+/**
+ * @brief Bulk channel counters
+ */
+struct zmk_esb_bulk_stats {
+    uint32_t tx_bytes;            // Acknowledged by the dongle
+    uint32_t rx_bytes;
+    uint32_t retransmits;         // Window rewinds after a retransmit timeout
+    uint32_t tx_bytes_per_sec;    // Throughput while data was in flight
+};
+
+/**
+ * @brief Write to the reliable bulk channel, e.g. for Studio RPC or keymap uploads
+ *
+ * Bulk traffic interleaves with HID frames at strictly lower priority and adds at
+ * most one ESB frame-time of latency to a keystroke.
+ *
+ * @param timeout How long to wait for the window to free up space
+ * @return Number of bytes written, possibly short on timeout, or -ENOTCONN
+ */
+int zmk_esb_bulk_write(const uint8_t *buf, size_t len, k_timeout_t timeout);
+
+typedef void (*zmk_esb_bulk_callback_t)(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Receive bulk channel data, in order, on the system workqueue
+ */
+void zmk_esb_bulk_set_callback(zmk_esb_bulk_callback_t callback);
+
+int zmk_esb_bulk_get_stats(struct zmk_esb_bulk_stats *stats);
+#endif
+
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+/**
+ * @brief Read part of a BLESB firmware image
+ *
+ * Reads are random access: a chunk is read again when it has to be resent.
+ */
+typedef int (*zmk_esb_dfu_read_t)(uint32_t offset, uint8_t *buf, size_t len, void *user_data);
+
+struct zmk_esb_dfu_image {
+    uint32_t size;
+    uint32_t crc;                 // CRC-32/IEEE of the whole image
+    zmk_esb_dfu_read_t read;
+    void *user_data;
+};
+
+/**
+ * @brief Stream a firmware image to BLESB over the UART link
+ *
+ * Blocks until BLESB has verified the image. The ESB link is reported as
+ * disconnected for the duration and comes back once BLESB restarts. A failed
+ * update of the same image resumes where it stopped.
+ *
+ * @return 0 on success, -ENOTCONN, -EBUSY if an update is running, -ETIMEDOUT
+ *         or -EIO if BLESB rejected the image
+ */
+int zmk_esb_dfu_update(const struct zmk_esb_dfu_image *image);
+
+/**
+ * @brief Bytes acknowledged by BLESB so far
+ *
+ * @return 0, or -ENODATA when no update is running
+ */
+int zmk_esb_dfu_get_progress(uint32_t *done, uint32_t *total);
+
+#if IS_ENABLED(CONFIG_FLASH_MAP)
+/**
+ * @brief Update BLESB from an image stored in a flash area, e.g. one staged
+ * there by a host over the bulk channel
+ */
+int zmk_esb_dfu_update_from_flash(uint8_t area_id, size_t size);
+#endif
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIME_SYNC)
+/**
+ * @brief Estimate of the dongle's USB poll timing
+ */
+struct zmk_esb_time_sync {
+    bool synced;                  // Fields below are 0 until true
+    uint32_t interval_us;         // USB poll interval
+    uint32_t jitter_us;           // Smoothed deviation of samples from the estimate
+    uint32_t next_poll_us;        // Time until the next USB SOF
+};
+
+int zmk_esb_get_time_sync(struct zmk_esb_time_sync *sync);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_POLL_ALIGN)
+/**
+ * @brief Hold HID frames until just ahead of the dongle's next USB poll
+ *
+ * Trades up to one poll interval of latency for a constant delay from report to
+ * host. Frames are sent at once while no poll estimate is available.
+ */
+void zmk_esb_set_poll_align(bool enable);
+bool zmk_esb_get_poll_align(void);
+#endif
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIMING)
+/**
+ * @brief Stages of a HID report's way from zmk_esb_hid_send_*() to the host
+ */
+enum zmk_esb_stage {
+    ZMK_ESB_STAGE_QUEUE,          // Waiting in the frame queue
+    ZMK_ESB_STAGE_UART,           // UART ring and wire up to BLESB
+    ZMK_ESB_STAGE_RADIO,          // BLESB to the dongle's ACK, retransmits included
+    ZMK_ESB_STAGE_USB,            // Dongle to the USB host picking it up
+    ZMK_ESB_STAGE_COUNT,
+};
+
+/**
+ * @brief Per-stage latency of timed frames, see CONFIG_ZMK_ESB_TIMING_SAMPLE_EVERY
+ */
+struct zmk_esb_timing {
+    uint32_t samples;             // Fields below are 0 until the first echo
+    struct {
+        uint16_t last_us;
+        uint16_t avg_us;          // Smoothed over recent samples
+        uint16_t max_us;
+    } stages[ZMK_ESB_STAGE_COUNT];
+};
+
+int zmk_esb_get_timing(struct zmk_esb_timing *timing);
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+/**
+ * @brief Latency histograms kept per report type
+ */
+enum zmk_esb_hist {
+    ZMK_ESB_HIST_SEND,            // Time spent in zmk_esb_hid_send_*()
+    ZMK_ESB_HIST_QUEUE,           // From zmk_esb_hid_send_*() until the frame leaves the queue
+    ZMK_ESB_HIST_WIRE,            // From the UART ring until the last byte is handed to the UART
+    ZMK_ESB_HIST_COUNT,
+};
+
+struct zmk_esb_hist_summary {
+    uint32_t count;
+    uint32_t p50_us;              // Upper bound of the log2 bucket, within 2x
+    uint32_t p99_us;
+    uint32_t max_us;              // Exact
+};
+
+/**
+ * @brief Summarize one histogram since boot or the last reset
+ *
+ * @return 0 on success, -EINVAL for an unknown type or histogram
+ */
+int zmk_esb_get_hist(enum zmk_esb_report_type type, enum zmk_esb_hist hist,
+                     struct zmk_esb_hist_summary *summary);
+
+void zmk_esb_reset_hist(void);
+#endif
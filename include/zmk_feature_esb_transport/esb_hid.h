@@ -1,26 +1,41 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include <zmk_feature_esb_transport/esb.h>
 
 /**
  * @brief Send keyboard HID report via ESB transport
- * 
- * @return 0 on success, negative error code on failure
+ *
+ * Never blocks. When the frame queue is full the report is refused with
+ * -EAGAIN and zmk_esb_tx_space_available is raised once there is room.
+ *
+ * @return 0 on success, -EAGAIN if the queue is full, other negative error
+ *         code on failure
  */
 int zmk_esb_hid_send_keyboard_report(void);
 
 /**
  * @brief Send consumer HID report via ESB transport
- * 
- * @return 0 on success, negative error code on failure  
+ *
+ * Never blocks. When the frame queue is full the report is refused with
+ * -EAGAIN and zmk_esb_tx_space_available is raised once there is room.
+ *
+ * @return 0 on success, -EAGAIN if the queue is full, other negative error
+ *         code on failure  
  */
 int zmk_esb_hid_send_consumer_report(void);
 
 #if IS_ENABLED(CONFIG_ZMK_POINTING)
 /**
  * @brief Send mouse HID report via ESB transport
- * 
- * @return 0 on success, negative error code on failure
+ *
+ * Never blocks. When the frame queue is full the report is refused with
+ * -EAGAIN and zmk_esb_tx_space_available is raised once there is room.
+ *
+ * @return 0 on success, -EAGAIN if the queue is full, other negative error
+ *         code on failure
  */
 int zmk_esb_hid_send_mouse_report(void);
 #endif
@@ -30,4 +45,22 @@ int zmk_esb_hid_send_mouse_report(void);
  * 
  * @return true if ESB HID is ready, false otherwise
  */
-bool zmk_esb_hid_is_ready(void);
\ No newline at end of file
+bool zmk_esb_hid_is_ready(void);
+
+struct zmk_esb_hid_stats {
+    uint32_t suppressed;          // Reports identical to the last one sent, skipped
+
+    // Token buckets, indexed by type - 1; all zero without CONFIG_ZMK_ESB_RATE_LIMIT
+    struct {
+        uint16_t tokens;          // Reports that may go out right now
+        uint16_t burst;           // Bucket size, 0 when the type is not limited
+        uint32_t limited;         // Reports held back and merged for lack of a token
+    } buckets[ZMK_ESB_REPORT_TYPE_COUNT];
+};
+
+/**
+ * @brief Get HID send statistics, summed over all ESB transport instances
+ *
+ * @return 0 on success, -EINVAL if stats is NULL
+ */
+int zmk_esb_hid_get_stats(struct zmk_esb_hid_stats *stats);
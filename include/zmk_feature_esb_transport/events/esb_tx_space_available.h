@@ -0,0 +1,10 @@
+#pragma once
+
+#include <zmk/event_manager.h>
+
+// Raised once the HID frame queue has room again after a send returned -EAGAIN
+struct zmk_esb_tx_space_available {
+    uint8_t report_types;   // BIT(ZMK_ESB_REPORT_*) of each type that was refused
+};
+
+ZMK_EVENT_DECLARE(zmk_esb_tx_space_available);
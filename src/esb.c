@@ -1,107 +1,715 @@
+#define DT_DRV_COMPAT zmk_esb_transport
+
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/uart.h>
 #include <zephyr/sys/reboot.h>
+#include <zephyr/sys/ring_buffer.h>
 #include <zephyr/logging/log.h>
 
 #include <zmk/event_manager.h>
 #include <zmk_feature_esb_transport/esb.h>
 #include <zmk_feature_esb_transport/events/esb_conn_state_changed.h>
 
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
-// Connection state management
-static bool esb_connected = false;
-static const struct device *esb_uart_dev;
+BUILD_ASSERT(DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT),
+             "CONFIG_ZMK_ESB requires an enabled zmk,esb-transport node");
+
+#if DT_HAS_CHOSEN(zmk_esb_transport)
+#define ESB_DEFAULT_NODE DT_CHOSEN(zmk_esb_transport)
+#else
+#define ESB_DEFAULT_NODE DT_DRV_INST(0)
+#endif
+
+#if DT_HAS_CHOSEN(zmk_esb_pointing_transport)
+#define ESB_POINTING_NODE DT_CHOSEN(zmk_esb_pointing_transport)
+#else
+#define ESB_POINTING_NODE ESB_DEFAULT_NODE
+#endif
+
+const struct device *esb_transport_default(void) { return DEVICE_DT_GET(ESB_DEFAULT_NODE); }
+
+const struct device *esb_transport_pointing(void) { return DEVICE_DT_GET(ESB_POINTING_NODE); }
+
+const struct device *esb_transport_for_report(enum zmk_esb_report_type type) {
+    return type == ZMK_ESB_REPORT_MOUSE ? esb_transport_pointing() : esb_transport_default();
+}
+
+// Bring BLESB in line with our state once it confirms ESB mode
+static void esb_transport_on_connected(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    // BLESB may have restarted with different firmware: stay on legacy frames
+    // until it answers the capabilities query below
+    data->max_payload = MIN(config->max_payload, ESB_PAYLOAD_LEGACY);
+    data->caps = 0;
+
+    esb_hid_forget(dev);
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    esb_bulk_reset(dev);
+#endif
+
+    int err = esb_pipe_sync(dev);
+    if (err) {
+        LOG_WRN("Failed to push ESB pipe routing (%d)", err);
+    }
+
+    // Cached dongle address and channel first, so reconnecting is one round trip
+    err = esb_profile_sync(dev);
+    if (err) {
+        LOG_WRN("Failed to push ESB profile (%d)", err);
+    }
+
+    err = esb_rate_sync(dev);
+    if (err) {
+        LOG_WRN("Failed to push ESB report rate (%d)", err);
+    }
+
+    err = esb_power_sync(dev);
+    if (err) {
+        LOG_WRN("Failed to push ESB latency mode (%d)", err);
+    }
+
+    err = esb_release_sync(dev);
+    if (err) {
+        LOG_WRN("Failed to push ESB link timeout (%d)", err);
+    }
+
+    err = esb_transport_send_ctrl(dev, ESB_CTRL_CAPS_QUERY, NULL, 0, K_NO_WAIT);
+    if (err) {
+        LOG_WRN("Failed to query BLESB capabilities (%d)", err);
+    }
+
+    err = esb_channel_sync(dev);
+    if (err) {
+        LOG_WRN("Failed to push ESB channel list (%d)", err);
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIME_SYNC)
+    err = esb_sync_start(dev);
+    if (err) {
+        LOG_WRN("Failed to start ESB time sync (%d)", err);
+    }
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+    esb_resync_start(dev);
+#endif
+}
 
 // Update ESB connection state and raise events
-static void update_esb_connection_state(bool connected) {
-    if (esb_connected != connected) {
-        esb_connected = connected;
-        
-        // Raise the event
-        raise_zmk_esb_conn_state_changed((struct zmk_esb_conn_state_changed){
-            .connected = connected
-        });
-        
-        LOG_INF("ESB connection: %s", connected ? "ready" : "not ready");
+static void update_esb_connection_state(const struct device *dev, bool connected) {
+    struct esb_transport_data *data = dev->data;
+
+    if (data->connected != connected) {
+        data->connected = connected;
+
+        // Endpoint selection follows the keyboard link only; a separate
+        // pointing link coming and going must not switch it
+        if (dev == esb_transport_default()) {
+            raise_zmk_esb_conn_state_changed((struct zmk_esb_conn_state_changed){
+                .connected = connected
+            });
+        }
+
+        LOG_INF("ESB connection (%s): %s", dev->name, connected ? "ready" : "not ready");
+
+        if (connected) {
+            esb_transport_on_connected(dev);
+        } else {
+            // Whatever is held must not repeat on the host until it times out
+            esb_release_all(dev);
+        }
     }
 }
 
-// Public API for esb_hid.c and core ZMK
+void esb_transport_set_connected(const struct device *dev, bool connected) {
+    update_esb_connection_state(dev, connected);
+}
+
+bool esb_transport_is_connected(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+    return data->connected;
+}
+
+// Public API for core ZMK
 bool zmk_esb_active_profile_is_connected(void) {
-    return esb_connected;
+    return esb_transport_is_connected(esb_transport_default());
 }
 
-// UART utility
-static void uart_send_string(const char *str) {
-    if (!esb_uart_dev || !device_is_ready(esb_uart_dev)) {
-        return;
+int zmk_esb_get_stats(struct zmk_esb_stats *stats) {
+    const struct device *dev;
+
+    if (stats == NULL) {
+        return -EINVAL;
     }
-    
-    size_t len = strlen(str);
-    for (size_t i = 0; i < len; i++) {
-        uart_poll_out(esb_uart_dev, str[i]);
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+
+        stats->frames += atomic_get(&data->stats.frames);
+        stats->tx_bytes += atomic_get(&data->stats.tx_bytes);
+        stats->rx_bytes += atomic_get(&data->stats.rx_bytes);
+        stats->dropped += atomic_get(&data->stats.dropped);
+        stats->refused += atomic_get(&data->stats.refused);
+        stats->retransmits += atomic_get(&data->stats.retransmits);
     }
+
+    return 0;
 }
 
-// UART RX callback - handles all protocol message processing
-static void uart_rx_callback(const struct device *dev, void *user_data) {
-    static char rx_buffer[32];
-    static int rx_pos = 0;
-    
-    uint8_t c;
-    while (uart_fifo_read(dev, &c, 1) == 1) {
-        if (c == '\n') {
-            rx_buffer[rx_pos] = '\0';
-            
-            // Process protocol messages directly in callback
-            if (strcmp(rx_buffer, "ESB") == 0) {
-                LOG_INF("BLESB confirmed ESB mode - enabling ESB transport");
-                update_esb_connection_state(true);
-                
-            } else if (strcmp(rx_buffer, "RST") == 0) {
-                LOG_INF("BLESB requesting reset - coordinated reboot");
-                uart_send_string("RST\n");  // ACK reset request
-                k_sleep(K_MSEC(50));        // Brief delay for UART TX
-                sys_reboot(SYS_REBOOT_COLD);
-                
-            } else {
-                LOG_WRN("Unknown BLESB message: %s", rx_buffer);
+void zmk_esb_reset_stats(void) {
+    const struct device *dev;
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+
+        atomic_set(&data->stats.frames, 0);
+        atomic_set(&data->stats.tx_bytes, 0);
+        atomic_set(&data->stats.rx_bytes, 0);
+        atomic_set(&data->stats.dropped, 0);
+        atomic_set(&data->stats.refused, 0);
+        atomic_set(&data->stats.retransmits, 0);
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+        atomic_set(&data->hid.suppressed, 0);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+        for (int type = 0; type < ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+            atomic_set(&data->limit.limited[type], 0);
+        }
+#endif
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+        atomic_set(&data->rate.merged, 0);
+        atomic_set(&data->rate.expired, 0);
+#endif
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+    zmk_esb_reset_hist();
+#endif
+}
+
+int esb_transport_tx(const struct device *dev, const uint8_t *buf, size_t len,
+                     k_timeout_t timeout) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    if (len > ring_buf_capacity_get(&data->tx_ring)) {
+        return -EMSGSIZE;
+    }
+
+    while (true) {
+        k_spinlock_key_t key = k_spin_lock(&data->tx_lock);
+
+        if (ring_buf_space_get(&data->tx_ring) >= len) {
+            ring_buf_put(&data->tx_ring, buf, len);
+            // Replies from the ISR may slip in while a thread holds the UART
+            // for bytes it has yet to queue, so only threads use up the hold
+            if (!k_is_in_isr()) {
+                data->power.tx_used = true;
             }
-            
-            rx_pos = 0;
-        } else if (rx_pos < sizeof(rx_buffer) - 1) {
-            rx_buffer[rx_pos++] = c;
+            k_spin_unlock(&data->tx_lock, key);
+            uart_irq_tx_enable(config->uart);
+            return 0;
+        }
+
+        k_spin_unlock(&data->tx_lock, key);
+
+        // Woken by the ISR each time it frees queue space
+        if (k_sem_take(&data->tx_space, timeout) != 0) {
+            return -EAGAIN;
+        }
+    }
+}
+
+size_t esb_transport_tx_pending(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    return ring_buf_size_get(&data->tx_ring);
+}
+
+int esb_transport_send_ctrl(const struct device *dev, uint8_t type, const void *payload,
+                            size_t len, k_timeout_t timeout) {
+    uint8_t frame[sizeof(struct hid_packet_header) + UINT8_MAX];
+    struct hid_packet_header *header = (struct hid_packet_header *)frame;
+
+    if (len > UINT8_MAX) {
+        return -EINVAL;
+    }
+
+    // Replies from the RX path imply the link is awake already
+    if (!k_is_in_isr()) {
+        esb_power_activity(dev, false);
+    }
+
+    header->type = type;
+    header->length = (uint8_t)len;
+    if (len > 0) {
+        memcpy(&frame[sizeof(struct hid_packet_header)], payload, len);
+    }
+
+    return esb_transport_tx(dev, frame, sizeof(struct hid_packet_header) + len, timeout);
+}
+
+// UART utility, safe to call from the RX callback
+static void uart_send_string(const struct device *dev, const char *str) {
+    if (esb_transport_tx(dev, (const uint8_t *)str, strlen(str), K_NO_WAIT) != 0) {
+        LOG_WRN("ESB UART TX queue full, dropped: %s", str);
+    }
+}
+
+void esb_transport_probe(const struct device *dev) { uart_send_string(dev, "ESB\n"); }
+
+static void esb_reboot_work_handler(struct k_work *work) {
+    sys_reboot(SYS_REBOOT_COLD);
+}
+
+// Handle one complete BLESB protocol message
+static void esb_handle_message(const struct device *dev, const char *msg) {
+    struct esb_transport_data *data = dev->data;
+
+    if (strcmp(msg, "ESB") == 0) {
+        LOG_INF("BLESB confirmed ESB mode - enabling ESB transport");
+        update_esb_connection_state(dev, true);
+
+    } else if (strcmp(msg, "RST") == 0) {
+        const struct device *inst;
+
+        LOG_INF("BLESB requesting reset - coordinated reboot");
+        // Nothing held may outlive the reboot on the host
+        for (int i = 0; (inst = esb_transport_get(i)) != NULL; i++) {
+            if (esb_transport_is_connected(inst)) {
+                esb_release_all(inst);
+            }
+        }
+        uart_send_string(dev, "RST\n");  // ACK reset request
+        // Brief delay for UART TX, which is drained by this same ISR
+        k_work_schedule(&data->reboot_work, K_MSEC(50));
+
+    } else {
+        LOG_WRN("Unknown BLESB message: %s", msg);
+    }
+}
+
+// BLESB lost or regained its radio link to the dongle
+static void esb_handle_link(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    const struct esb_evt_link *evt = (const void *)payload;
+
+    if (len < sizeof(*evt)) {
+        return;
+    }
+
+    // Whatever is held must not repeat on the host while the link is down
+    if (!evt->up) {
+        esb_release_all(dev);
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_REPLAY)
+    // After the release, which forgets any replay, so the loss is recorded
+    esb_replay_handle_link(dev, payload, len);
+#endif
+}
+
+static void esb_handle_caps(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    const struct esb_evt_caps *caps = (const void *)payload;
+
+    if (len < sizeof(*caps)) {
+        LOG_WRN("Invalid BLESB capabilities");
+        return;
+    }
+
+    // Fragment and bulk framing take their headers out of every payload, so
+    // anything below the classic size keeps it
+    if (caps->max_payload < ESB_PAYLOAD_LEGACY) {
+        LOG_WRN("BLESB payload of %d bytes too small, staying at %d", caps->max_payload,
+                ESB_PAYLOAD_LEGACY);
+        return;
+    }
+
+    data->max_payload = MIN(caps->max_payload, config->max_payload);
+    data->caps = caps->flags;
+
+    LOG_INF("BLESB v%d: %d byte payloads, flags 0x%02x", caps->version, data->max_payload,
+            data->caps);
+}
+
+// Handle one complete BLESB binary frame
+void esb_transport_handle_frame(const struct device *dev, uint8_t type, const uint8_t *payload,
+                                uint8_t len) {
+    switch (type) {
+    case ESB_EVT_CHANNEL_STATS:
+        esb_channel_handle_stats(dev, payload, len);
+        break;
+    case ESB_EVT_CHANNEL_ACTIVE:
+        esb_channel_handle_active(dev, payload, len);
+        break;
+    case ESB_EVT_PAIRED:
+        esb_profile_handle_paired(dev, payload, len);
+        break;
+    case ESB_EVT_CAPS:
+        esb_handle_caps(dev, payload, len);
+        break;
+    case ESB_FRAME_FRAGMENT:
+        esb_frag_handle(dev, payload, len);
+        break;
+    case ESB_EVT_HID_OUTPUT:
+        esb_hid_handle_output(dev, payload, len);
+        break;
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIMING)
+    case ESB_EVT_TIMING:
+        esb_timing_handle(dev, payload, len);
+        break;
+#endif
+    case ESB_EVT_LINK:
+        esb_handle_link(dev, payload, len);
+        break;
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIME_SYNC)
+    case ESB_EVT_TIME_SYNC:
+        esb_sync_handle(dev, payload, len);
+        break;
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    case ESB_FRAME_BULK_DATA:
+    case ESB_FRAME_BULK_ACK:
+        esb_bulk_handle(dev, type, payload, len);
+        break;
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+    case ESB_EVT_BAUD:
+        esb_dfu_handle_baud(dev, payload, len);
+        break;
+    case ESB_EVT_DFU_STATUS:
+        esb_dfu_handle_status(dev, payload, len);
+        break;
+#endif
+    default:
+        LOG_WRN("Unknown BLESB frame type 0x%02x", type);
+        break;
+    }
+}
+
+static void esb_uart_rx_byte(const struct device *dev, uint8_t c) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    // The first byte decides between a binary frame and a text line
+    if (data->rx_pos == 0 && c != '\n' && c <= ESB_FRAME_TYPE_MAX) {
+        data->rx_frame = true;
+    }
+
+    if (data->rx_frame) {
+        // Oversized frames are consumed but dropped
+        if (data->rx_pos < config->rx_buf_size) {
+            config->rx_buf[data->rx_pos] = c;
+        }
+        data->rx_pos++;
+
+        if (data->rx_pos < sizeof(struct hid_packet_header)) {
+            return;
+        }
+
+        size_t frame_len = sizeof(struct hid_packet_header) + config->rx_buf[1];
+        if (data->rx_pos < frame_len) {
+            return;
         }
+
+        if (frame_len <= config->rx_buf_size) {
+            esb_transport_handle_frame(dev, config->rx_buf[0], &config->rx_buf[2], config->rx_buf[1]);
+        } else {
+            LOG_WRN("BLESB frame too large: %zu bytes", frame_len);
+        }
+
+        data->rx_pos = 0;
+        data->rx_frame = false;
+        return;
+    }
+
+    if (c == '\n') {
+        config->rx_buf[data->rx_pos] = '\0';
+        esb_handle_message(dev, (const char *)config->rx_buf);
+        data->rx_pos = 0;
+    } else if (data->rx_pos < config->rx_buf_size - 1) {
+        config->rx_buf[data->rx_pos++] = c;
+    }
+}
+
+static void esb_uart_rx(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    atomic_val_t count = 0;
+
+    uint8_t c;
+    while (uart_fifo_read(config->uart, &c, 1) == 1) {
+        esb_uart_rx_byte(dev, c);
+        count++;
+    }
+
+    atomic_add(&data->stats.rx_bytes, count);
+}
+
+static void esb_uart_tx(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->tx_lock);
+    uint8_t *buf;
+    uint32_t len = ring_buf_get_claim(&data->tx_ring, &buf, config->tx_queue_size);
+    int sent = 0;
+
+    if (len == 0) {
+        uart_irq_tx_disable(config->uart);
+    } else {
+        sent = MAX(uart_fifo_fill(config->uart, buf, len), 0);
+        ring_buf_get_finish(&data->tx_ring, sent);
+    }
+    k_spin_unlock(&data->tx_lock, key);
+
+    atomic_add(&data->stats.tx_bytes, sent);
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+    esb_hist_note_wire(dev, sent);
+#endif
+
+    k_sem_give(&data->tx_space);
+    if (len == 0) {
+        esb_power_tx_idle(dev);
+    } else {
+        esb_power_note_resume_tx(dev);
+    }
+    esb_hid_tx_ready(dev);
+}
+
+// UART ISR - handles all protocol message processing and TX draining
+static void esb_uart_callback(const struct device *uart, void *user_data) {
+    const struct device *dev = user_data;
+
+    if (!uart_irq_update(uart)) {
+        return;
+    }
+
+    if (uart_irq_rx_ready(uart)) {
+        esb_uart_rx(dev);
     }
+
+    if (uart_irq_tx_ready(uart)) {
+        esb_uart_tx(dev);
+    }
+}
+
+int esb_transport_get_baud(const struct device *dev, uint32_t *baudrate) {
+#if IS_ENABLED(CONFIG_UART_USE_RUNTIME_CONFIGURE)
+    const struct esb_transport_config *config = dev->config;
+    struct uart_config uart_cfg;
+
+    int err = uart_config_get(config->uart, &uart_cfg);
+    if (err) {
+        return err;
+    }
+
+    *baudrate = uart_cfg.baudrate;
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
 }
 
-// ESB initialization function
-static int zmk_esb_init(void) {
-    LOG_INF("Initializing ESB transport");
-    
-    // Get UART device
-    esb_uart_dev = DEVICE_DT_GET(DT_CHOSEN(zmk_esb_uart));
-    
-    if (!device_is_ready(esb_uart_dev)) {
+int esb_transport_set_baud(const struct device *dev, uint32_t baudrate) {
+#if IS_ENABLED(CONFIG_UART_USE_RUNTIME_CONFIGURE)
+    const struct esb_transport_config *config = dev->config;
+    struct uart_config uart_cfg;
+
+    int err = uart_config_get(config->uart, &uart_cfg);
+    if (err) {
+        return err;
+    }
+
+    if (uart_cfg.baudrate == baudrate) {
+        return 0;
+    }
+
+    uart_cfg.baudrate = baudrate;
+    return uart_configure(config->uart, &uart_cfg);
+#else
+    return -ENOTSUP;
+#endif
+}
+
+static int esb_apply_baud_target(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+
+    if (config->baud_target == 0) {
+        return 0;
+    }
+
+    return esb_transport_set_baud(dev, config->baud_target);
+}
+
+// Sample BLESB RTS/CTS: ESB mode is RTS inactive, CTS active
+static bool esb_mode_detected(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+
+    if (!config->has_mode_detect) {
+        return true;
+    }
+
+    if (!gpio_is_ready_dt(&config->rts_gpio) || !gpio_is_ready_dt(&config->cts_gpio)) {
+        LOG_WRN("ESB mode detect GPIOs not ready - assuming ESB mode");
+        return true;
+    }
+
+    gpio_pin_configure_dt(&config->rts_gpio, GPIO_INPUT);
+    gpio_pin_configure_dt(&config->cts_gpio, GPIO_INPUT);
+
+    int rts = gpio_pin_get_dt(&config->rts_gpio);
+    int cts = gpio_pin_get_dt(&config->cts_gpio);
+
+    // Release the lines for the UART/HCI to use
+    gpio_pin_configure_dt(&config->rts_gpio, GPIO_DISCONNECTED);
+    gpio_pin_configure_dt(&config->cts_gpio, GPIO_DISCONNECTED);
+
+    return rts == 0 && cts == 1;
+}
+
+// ESB initialization function, once per instance
+static int esb_transport_init(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    LOG_INF("Initializing ESB transport %s", dev->name);
+
+    data->dev = dev;
+    data->max_payload = MIN(config->max_payload, ESB_PAYLOAD_LEGACY);
+    ring_buf_init(&data->tx_ring, config->tx_queue_size, config->tx_queue);
+    k_sem_init(&data->tx_space, 0, 1);
+    k_work_init_delayable(&data->reboot_work, esb_reboot_work_handler);
+    esb_pipe_init(dev);
+    esb_channel_init(dev);
+    esb_profile_init(dev);
+    esb_rate_init(dev);
+    esb_hid_queue_init(dev);
+    esb_frag_init(dev);
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    esb_bulk_init(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+    esb_dfu_init(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIME_SYNC)
+    esb_sync_init(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    esb_limit_init(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIMING)
+    esb_timing_init(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+    esb_hist_init(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_REDUNDANT_KEYS)
+    esb_redundant_init(dev);
+#endif
+
+    if (!device_is_ready(config->uart)) {
         LOG_ERR("ESB UART device not ready");
         return -ENODEV;
     }
-    
-    // Set up UART interrupt for receiving messages
-    uart_irq_callback_user_data_set(esb_uart_dev, uart_rx_callback, NULL);
-    uart_irq_rx_enable(esb_uart_dev);
-    
+
     // ESB starts disabled (like BLE) - callback will enable if BLESB responds
-    update_esb_connection_state(false);
-    
+    if (!esb_mode_detected(dev)) {
+        LOG_INF("BLESB not in ESB mode - ESB transport stays disabled");
+        return 0;
+    }
+
+    // Only now is the UART ours to hold
+    esb_power_init(dev);
+
+    int err = esb_apply_baud_target(dev);
+    if (err) {
+        LOG_WRN("Failed to set ESB UART baud rate to %u (%d)", config->baud_target, err);
+    }
+
+    // Set up UART interrupt for receiving messages
+    uart_irq_callback_user_data_set(config->uart, esb_uart_callback, (void *)dev);
+    uart_irq_rx_enable(config->uart);
+
     // Query BLESB - async response via callback
     LOG_INF("Querying BLESB for ESB availability");
-    uart_send_string("ESB\n");
-    
+    esb_transport_probe(dev);
+
     LOG_INF("ESB transport initialized - waiting for BLESB response");
     return 0;  // Always succeeds, async response enables transport
 }
 
-SYS_INIT(zmk_esb_init, APPLICATION, CONFIG_ZMK_ESB_INIT_PRIORITY);
\ No newline at end of file
+#define ESB_TRANSPORT_INST(n)                                                                      \
+    BUILD_ASSERT(DT_INST_PROP(n, max_payload) <= UINT8_MAX, "max-payload must fit a frame");     \
+    BUILD_ASSERT(DT_INST_PROP(n, max_payload) >= ESB_PAYLOAD_LEGACY,                              \
+                 "max-payload must hold a classic ESB payload");                                  \
+    BUILD_ASSERT(DT_INST_PROP(n, tx_queue_size) >= 2 * DT_INST_PROP(n, max_payload),             \
+                 "tx-queue-size must hold two max-payload frames");                               \
+    BUILD_ASSERT(DT_INST_PROP(n, frame_queue_depth) < ESB_FRAME_NONE,                              \
+                 "frame-queue-depth must be below 255");                                          \
+                                                                                                   \
+    static uint8_t esb_tx_queue_##n[DT_INST_PROP(n, tx_queue_size)];                              \
+    static struct esb_frame esb_frames_##n[DT_INST_PROP(n, frame_queue_depth)];                   \
+    static uint8_t esb_batch_buf_##n[DT_INST_PROP(n, max_payload)];                               \
+    static uint8_t esb_rx_buf_##n[DT_INST_PROP(n, rx_queue_size)];                                \
+    static const uint8_t esb_rf_channels_##n[] = COND_CODE_1(                                      \
+        DT_INST_NODE_HAS_PROP(n, rf_channels), (DT_INST_PROP(n, rf_channels)),                    \
+        (ESB_CHANNELS_DEFAULT));                                                                   \
+                                                                                                   \
+    static const struct esb_transport_config esb_transport_config_##n = {                         \
+        .index = n,                                                                                \
+        .uart = DEVICE_DT_GET(DT_INST_PHANDLE(n, uart)),                                          \
+        .baud_target = DT_INST_PROP_OR(n, baud_target, 0),                                        \
+        .dfu_baud = DT_INST_PROP_OR(n, dfu_baud, 0),                                              \
+        .max_payload = DT_INST_PROP(n, max_payload),                                              \
+        .tx_queue = esb_tx_queue_##n,                                                             \
+        .tx_queue_size = sizeof(esb_tx_queue_##n),                                                \
+        .frames = esb_frames_##n,                                                                 \
+        .frame_queue_depth = ARRAY_SIZE(esb_frames_##n),                                          \
+        .batch_buf = esb_batch_buf_##n,                                                           \
+        .rx_buf = esb_rx_buf_##n,                                                                 \
+        .rx_buf_size = sizeof(esb_rx_buf_##n),                                                    \
+        .rf_channels = esb_rf_channels_##n,                                                       \
+        .rf_channel_count = sizeof(esb_rf_channels_##n),                                          \
+        .has_mode_detect = DT_INST_NODE_HAS_PROP(n, mode_detect_gpios),                           \
+        .rts_gpio = GPIO_DT_SPEC_INST_GET_BY_IDX_OR(n, mode_detect_gpios, 0, {0}),                \
+        .cts_gpio = GPIO_DT_SPEC_INST_GET_BY_IDX_OR(n, mode_detect_gpios, 1, {0}),                \
+        .has_wake = DT_INST_NODE_HAS_PROP(n, wake_gpios),                                          \
+        .wake_gpio = GPIO_DT_SPEC_INST_GET_OR(n, wake_gpios, {0}),                                 \
+        .has_host_wake = DT_INST_NODE_HAS_PROP(n, host_wake_gpios),                                \
+        .host_wake_gpio = GPIO_DT_SPEC_INST_GET_OR(n, host_wake_gpios, {0}),                       \
+    };                                                                                             \
+                                                                                                   \
+    static struct esb_transport_data esb_transport_data_##n;                                       \
+                                                                                                   \
+    DEVICE_DT_INST_DEFINE(n, esb_transport_init, NULL, &esb_transport_data_##n,                    \
+                          &esb_transport_config_##n, APPLICATION, CONFIG_ZMK_ESB_INIT_PRIORITY,   \
+                          NULL);
+
+DT_INST_FOREACH_STATUS_OKAY(ESB_TRANSPORT_INST)
+
+#define ESB_TRANSPORT_DEV(n) DEVICE_DT_INST_GET(n),
+
+static const struct device *const esb_transport_devs[] = {
+    DT_INST_FOREACH_STATUS_OKAY(ESB_TRANSPORT_DEV)
+};
+
+const struct device *esb_transport_get(int index) {
+    if (index < 0 || index >= ARRAY_SIZE(esb_transport_devs)) {
+        return NULL;
+    }
+
+    return esb_transport_devs[index];
+}
@@ -0,0 +1,291 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define ESB_BULK_OVERHEAD (sizeof(struct hid_packet_header) + sizeof(struct esb_bulk_header))
+#define ESB_BULK_TX_SIZE CONFIG_ZMK_ESB_BULK_TX_BUF_SIZE
+#define ESB_BULK_WINDOW CONFIG_ZMK_ESB_BULK_WINDOW
+
+BUILD_ASSERT(IS_POWER_OF_TWO(ESB_BULK_TX_SIZE), "Bulk TX buffer size must be a power of two");
+BUILD_ASSERT(IS_POWER_OF_TWO(ESB_BULK_WINDOW), "Bulk window must be a power of two");
+
+static zmk_esb_bulk_callback_t esb_bulk_callback;
+
+// Sequence numbers wrap, so compare them by signed distance
+static int16_t esb_bulk_seq_diff(uint16_t a, uint16_t b) { return (int16_t)(a - b); }
+
+static uint16_t esb_bulk_in_flight(const struct esb_transport_data *data) {
+    return data->bulk.next_seq - data->bulk.base_seq;
+}
+
+bool esb_bulk_pending(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+    return data->bulk.sent != data->bulk.head && esb_bulk_in_flight(data) < ESB_BULK_WINDOW;
+}
+
+// Written data not yet acknowledged: an ACK from the UART ISR may reopen the
+// window at any time, and the segments it lets out need the UART
+bool esb_bulk_busy(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+    return data->bulk.tail != data->bulk.head;
+}
+
+// Emit the next segment inside the window, or return 0. Bulk frames are only
+// packed once the HID queue is empty, so they never get ahead of a keystroke.
+size_t esb_bulk_pack(const struct device *dev, uint8_t *out) {
+    struct esb_transport_data *data = dev->data;
+    size_t len = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&data->bulk.lock);
+
+    if (esb_bulk_pending(dev)) {
+        size_t chunk = MIN(data->max_payload - ESB_BULK_OVERHEAD,
+                           data->bulk.head - data->bulk.sent);
+        uint16_t seq = data->bulk.next_seq++;
+
+        struct hid_packet_header *header = (struct hid_packet_header *)out;
+        struct esb_bulk_header *bulk = (struct esb_bulk_header *)&out[sizeof(*header)];
+
+        header->type = ESB_FRAME_BULK_DATA;
+        header->length = sizeof(*bulk) + chunk;
+        bulk->seq = sys_cpu_to_le16(seq);
+
+        for (size_t i = 0; i < chunk; i++) {
+            out[ESB_BULK_OVERHEAD + i] =
+                data->bulk.tx_buf[(data->bulk.sent + i) % ESB_BULK_TX_SIZE];
+        }
+
+        data->bulk.sent += chunk;
+        data->bulk.seg_end[seq % ESB_BULK_WINDOW] = data->bulk.sent;
+        len = ESB_BULK_OVERHEAD + chunk;
+
+        if (!k_work_delayable_is_pending(&data->bulk.retransmit_work)) {
+            k_work_schedule(&data->bulk.retransmit_work,
+                            K_MSEC(CONFIG_ZMK_ESB_BULK_RETRANSMIT_MS));
+        }
+    }
+
+    k_spin_unlock(&data->bulk.lock, key);
+    return len;
+}
+
+// Go-back-N: resend everything after the last acknowledged segment
+static void esb_bulk_retransmit_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, bulk.retransmit_work);
+
+    k_spinlock_key_t key = k_spin_lock(&data->bulk.lock);
+    bool rewound = esb_bulk_in_flight(data) > 0;
+    if (rewound) {
+        data->bulk.sent = data->bulk.tail;
+        data->bulk.next_seq = data->bulk.base_seq;
+        data->bulk.stats.retransmits++;
+    }
+    k_spin_unlock(&data->bulk.lock, key);
+
+    if (rewound) {
+        LOG_DBG("ESB bulk retransmit from segment %d", data->bulk.base_seq);
+        // BLESB may have gone idle while waiting for the ACK
+        esb_power_activity(data->dev, false);
+        esb_hid_flush(data->dev);
+    }
+}
+
+static void esb_bulk_handle_ack(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_bulk_header *ack = (const void *)payload;
+
+    if (len < sizeof(*ack)) {
+        return;
+    }
+
+    uint16_t next = sys_le16_to_cpu(ack->seq);
+
+    k_spinlock_key_t key = k_spin_lock(&data->bulk.lock);
+
+    // Cumulative: everything before next was received
+    int16_t acked = esb_bulk_seq_diff(next, data->bulk.base_seq);
+    if (acked > 0 && esb_bulk_seq_diff(data->bulk.next_seq, next) >= 0) {
+        uint32_t end = data->bulk.seg_end[(uint16_t)(next - 1) % ESB_BULK_WINDOW];
+        int64_t now = k_uptime_get();
+
+        data->bulk.stats.tx_bytes += end - data->bulk.tail;
+        data->bulk.stats.busy_ms += now - data->bulk.busy_since;
+        data->bulk.busy_since = now;
+        data->bulk.tail = end;
+        data->bulk.base_seq = next;
+
+        if (esb_bulk_in_flight(data) > 0) {
+            k_work_reschedule(&data->bulk.retransmit_work,
+                              K_MSEC(CONFIG_ZMK_ESB_BULK_RETRANSMIT_MS));
+        } else {
+            k_work_cancel_delayable(&data->bulk.retransmit_work);
+        }
+    }
+
+    bool done = data->bulk.tail == data->bulk.head;
+    k_spin_unlock(&data->bulk.lock, key);
+
+    k_sem_give(&data->bulk.tx_space);
+    esb_hid_tx_ready(dev);
+
+    // The TX queue may have drained long before this last ACK, with the
+    // UART still held for it
+    if (done) {
+        esb_power_tx_idle(dev);
+    }
+}
+
+static void esb_bulk_send_ack(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+    struct esb_bulk_header ack = {
+        .seq = sys_cpu_to_le16(data->bulk.rx_next),
+    };
+
+    esb_transport_send_ctrl(dev, ESB_FRAME_BULK_ACK, &ack, sizeof(ack), K_NO_WAIT);
+}
+
+static void esb_bulk_handle_data(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_bulk_header *bulk = (const void *)payload;
+
+    if (len < sizeof(*bulk)) {
+        return;
+    }
+
+    const uint8_t *body = &payload[sizeof(*bulk)];
+    size_t body_len = len - sizeof(*bulk);
+
+    // Accept in order only, and only what can be buffered; the sender resends
+    // everything else after its retransmit timeout
+    if (sys_le16_to_cpu(bulk->seq) == data->bulk.rx_next &&
+        ring_buf_space_get(&data->bulk.rx_ring) >= body_len) {
+        ring_buf_put(&data->bulk.rx_ring, body, body_len);
+        data->bulk.rx_next++;
+        data->bulk.stats.rx_bytes += body_len;
+        k_work_submit(&data->bulk.rx_work);
+    }
+
+    esb_bulk_send_ack(dev);
+}
+
+void esb_bulk_handle(const struct device *dev, uint8_t type, const uint8_t *payload,
+                     uint8_t len) {
+    if (type == ESB_FRAME_BULK_ACK) {
+        esb_bulk_handle_ack(dev, payload, len);
+    } else {
+        esb_bulk_handle_data(dev, payload, len);
+    }
+}
+
+static void esb_bulk_rx_work(struct k_work *work) {
+    struct esb_transport_data *data = CONTAINER_OF(work, struct esb_transport_data, bulk.rx_work);
+    uint8_t buf[32];
+    uint32_t len;
+
+    while ((len = ring_buf_get(&data->bulk.rx_ring, buf, sizeof(buf))) > 0) {
+        if (esb_bulk_callback) {
+            esb_bulk_callback(buf, len);
+        }
+    }
+}
+
+void esb_bulk_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    ring_buf_init(&data->bulk.rx_ring, sizeof(data->bulk.rx_buf), data->bulk.rx_buf);
+    k_sem_init(&data->bulk.tx_space, 0, 1);
+    k_work_init_delayable(&data->bulk.retransmit_work, esb_bulk_retransmit_work);
+    k_work_init(&data->bulk.rx_work, esb_bulk_rx_work);
+}
+
+// BLESB starts both directions over at segment 0 whenever it confirms ESB
+// mode; bytes not acknowledged before are sent again from there
+void esb_bulk_reset(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->bulk.lock);
+    data->bulk.sent = data->bulk.tail;
+    data->bulk.base_seq = 0;
+    data->bulk.next_seq = 0;
+    data->bulk.rx_next = 0;
+    if (data->bulk.tail != data->bulk.head) {
+        data->bulk.busy_since = k_uptime_get();
+    }
+    k_spin_unlock(&data->bulk.lock, key);
+
+    k_work_cancel_delayable(&data->bulk.retransmit_work);
+    esb_hid_tx_ready(dev);
+}
+
+int zmk_esb_bulk_write(const uint8_t *buf, size_t len, k_timeout_t timeout) {
+    const struct device *dev = esb_transport_default();
+    struct esb_transport_data *data = dev->data;
+    size_t written = 0;
+
+    if (!esb_transport_is_connected(dev)) {
+        return -ENOTCONN;
+    }
+
+    esb_power_activity(dev, false);
+
+    while (written < len) {
+        k_spinlock_key_t key = k_spin_lock(&data->bulk.lock);
+
+        if (data->bulk.tail == data->bulk.head) {
+            data->bulk.busy_since = k_uptime_get();
+        }
+
+        size_t space = ESB_BULK_TX_SIZE - (data->bulk.head - data->bulk.tail);
+        size_t chunk = MIN(space, len - written);
+        for (size_t i = 0; i < chunk; i++) {
+            data->bulk.tx_buf[(data->bulk.head + i) % ESB_BULK_TX_SIZE] = buf[written + i];
+        }
+        data->bulk.head += chunk;
+        written += chunk;
+
+        k_spin_unlock(&data->bulk.lock, key);
+
+        esb_hid_flush(dev);
+
+        // Space is freed as BLESB acknowledges segments
+        if (written < len && k_sem_take(&data->bulk.tx_space, timeout) != 0) {
+            break;
+        }
+    }
+
+    return written;
+}
+
+void zmk_esb_bulk_set_callback(zmk_esb_bulk_callback_t callback) {
+    esb_bulk_callback = callback;
+}
+
+int zmk_esb_bulk_get_stats(struct zmk_esb_bulk_stats *stats) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+
+    if (stats == NULL) {
+        return -EINVAL;
+    }
+
+    stats->tx_bytes = data->bulk.stats.tx_bytes;
+    stats->rx_bytes = data->bulk.stats.rx_bytes;
+    stats->retransmits = data->bulk.stats.retransmits;
+    stats->tx_bytes_per_sec =
+        data->bulk.stats.busy_ms > 0
+            ? (uint32_t)((uint64_t)data->bulk.stats.tx_bytes * 1000 / data->bulk.stats.busy_ms)
+            : 0;
+    return 0;
+}
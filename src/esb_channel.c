@@ -0,0 +1,241 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Each BLESB report moves a channel's failure rate 1/4 of the way to the new sample
+#define ESB_CHANNEL_EWMA_SHIFT 2
+// Channels not in use decay by 1/16 per report, so congested ones get retried later
+#define ESB_CHANNEL_RECOVERY_SHIFT 4
+
+static int esb_channel_index(const struct esb_transport_data *data, uint8_t channel) {
+    for (int i = 0; i < data->channels.count; i++) {
+        if (data->channels.list[i] == channel) {
+            return i;
+        }
+    }
+
+    return -ENOENT;
+}
+
+static int esb_channel_send_list(const struct device *dev, k_timeout_t timeout) {
+    const struct esb_transport_data *data = dev->data;
+    uint8_t msg[1 + ZMK_ESB_CHANNELS_MAX];
+
+    msg[0] = data->channels.count;
+    memcpy(&msg[1], data->channels.list, data->channels.count);
+
+    return esb_transport_send_ctrl(dev, ESB_CTRL_CHANNEL_LIST, msg, 1 + data->channels.count,
+                                   timeout);
+}
+
+static int esb_channel_send_switch(const struct device *dev, uint8_t channel,
+                                   k_timeout_t timeout) {
+    struct esb_ctrl_channel_switch msg = {
+        .channel = channel,
+    };
+
+    return esb_transport_send_ctrl(dev, ESB_CTRL_CHANNEL_SWITCH, &msg, sizeof(msg), timeout);
+}
+
+void esb_channel_init(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    data->channels.count = MIN(config->rf_channel_count, ZMK_ESB_CHANNELS_MAX);
+    memcpy(data->channels.list, config->rf_channels, data->channels.count);
+    memset(data->channels.fail_permille, 0, sizeof(data->channels.fail_permille));
+    data->channels.active = 0;
+    data->channels.last_hop = 0;
+}
+
+// Push the channel list and the channel to start on
+int esb_channel_sync(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+    int err = esb_channel_send_list(dev, K_NO_WAIT);
+    if (err) {
+        return err;
+    }
+
+    return esb_channel_send_switch(dev, data->channels.list[data->channels.active], K_NO_WAIT);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_CHANNEL_HOPPING)
+// Pick a clearly better channel once the active one fails too often, or -1
+static int esb_channel_pick_hop(struct esb_transport_data *data) {
+    uint8_t active = data->channels.active;
+    uint16_t active_rate = data->channels.fail_permille[active];
+    int64_t now = k_uptime_get();
+
+    if (data->channels.count < 2 || active_rate < CONFIG_ZMK_ESB_CHANNEL_HOP_THRESHOLD ||
+        now - data->channels.last_hop < CONFIG_ZMK_ESB_CHANNEL_HOP_HOLDOFF_MS) {
+        return -1;
+    }
+
+    int best = -1;
+    for (int i = 0; i < data->channels.count; i++) {
+        if (i != active &&
+            (best < 0 || data->channels.fail_permille[i] < data->channels.fail_permille[best])) {
+            best = i;
+        }
+    }
+
+    if (data->channels.fail_permille[best] + CONFIG_ZMK_ESB_CHANNEL_HOP_HYSTERESIS >=
+        active_rate) {
+        return -1;
+    }
+
+    data->channels.last_hop = now;
+    return best;
+}
+#endif
+
+void esb_channel_handle_stats(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->channels.lock);
+
+    for (size_t off = 0; off + sizeof(struct esb_evt_channel_stats) <= len;
+         off += sizeof(struct esb_evt_channel_stats)) {
+        const struct esb_evt_channel_stats *entry = (const void *)&payload[off];
+        uint16_t attempts = sys_le16_to_cpu(entry->attempts);
+        uint16_t failures = sys_le16_to_cpu(entry->failures);
+        int idx = esb_channel_index(data, entry->channel);
+
+        atomic_add(&data->stats.retransmits, failures);
+        if (idx < 0 || attempts == 0) {
+            continue;
+        }
+
+        uint16_t sample = MIN(failures, attempts) * 1000U / attempts;
+        uint16_t *rate = &data->channels.fail_permille[idx];
+        *rate = *rate - (*rate >> ESB_CHANNEL_EWMA_SHIFT) + (sample >> ESB_CHANNEL_EWMA_SHIFT);
+    }
+
+    for (int i = 0; i < data->channels.count; i++) {
+        if (i != data->channels.active) {
+            data->channels.fail_permille[i] -=
+                data->channels.fail_permille[i] >> ESB_CHANNEL_RECOVERY_SHIFT;
+        }
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_CHANNEL_HOPPING)
+    uint8_t from = data->channels.list[data->channels.active];
+    uint16_t from_rate = data->channels.fail_permille[data->channels.active];
+    int hop = esb_channel_pick_hop(data);
+    uint8_t to = hop >= 0 ? data->channels.list[hop] : 0;
+#endif
+
+    k_spin_unlock(&data->channels.lock, key);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_CHANNEL_HOPPING)
+    if (hop < 0) {
+        return;
+    }
+
+    // The active channel only changes once BLESB confirms the hop
+    LOG_INF("ESB channel %d failing at %d permille - hopping to %d", from, from_rate, to);
+    int err = esb_channel_send_switch(dev, to, K_NO_WAIT);
+    if (err) {
+        LOG_WRN("Failed to request ESB channel hop (%d)", err);
+    }
+#endif
+}
+
+void esb_channel_set_active(const struct device *dev, uint8_t channel) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->channels.lock);
+    int idx = esb_channel_index(data, channel);
+    if (idx >= 0) {
+        data->channels.active = idx;
+    }
+    k_spin_unlock(&data->channels.lock, key);
+
+    if (idx < 0) {
+        LOG_WRN("ESB channel %d is outside the channel list", channel);
+    }
+}
+
+void esb_channel_handle_active(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    if (len < 1) {
+        return;
+    }
+
+    esb_channel_set_active(dev, payload[0]);
+    esb_profile_note_channel(dev, payload[0]);
+
+    LOG_INF("ESB now on channel %d", payload[0]);
+}
+
+int zmk_esb_set_channels(const uint8_t *channels, size_t count) {
+    if (channels == NULL || count == 0 || count > ZMK_ESB_CHANNELS_MAX) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (channels[i] > ZMK_ESB_CHANNEL_MAX) {
+            return -EINVAL;
+        }
+    }
+
+    const struct device *dev = esb_transport_default();
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->channels.lock);
+    memcpy(data->channels.list, channels, count);
+    memset(data->channels.fail_permille, 0, sizeof(data->channels.fail_permille));
+    data->channels.count = count;
+    data->channels.active = 0;
+    k_spin_unlock(&data->channels.lock, key);
+
+    // Pushed on connect otherwise
+    if (!esb_transport_is_connected(dev)) {
+        return 0;
+    }
+
+    int err = esb_channel_send_list(dev, K_FOREVER);
+    if (err) {
+        return err;
+    }
+
+    return esb_channel_send_switch(dev, channels[0], K_FOREVER);
+}
+
+int zmk_esb_get_channels(uint8_t *channels, size_t size) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+    size_t count;
+
+    if (channels == NULL || size == 0) {
+        return -EINVAL;
+    }
+
+    count = MIN(size, data->channels.count);
+    memcpy(channels, data->channels.list, count);
+    return count;
+}
+
+uint8_t zmk_esb_get_active_channel(void) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+
+    return data->channels.list[data->channels.active];
+}
+
+int zmk_esb_get_channel_failure_rate(uint8_t channel) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+    int idx = esb_channel_index(data, channel);
+
+    if (idx < 0) {
+        return idx;
+    }
+
+    return data->channels.fail_permille[idx];
+}
@@ -0,0 +1,401 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+
+#if IS_ENABLED(CONFIG_FLASH_MAP)
+#include <zephyr/storage/flash_map.h>
+#endif
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define ESB_DFU_OVERHEAD (sizeof(struct hid_packet_header) + sizeof(struct esb_dfu_chunk_header))
+#define ESB_DFU_TIMEOUT K_MSEC(CONFIG_ZMK_ESB_DFU_TIMEOUT_MS)
+#define ESB_DFU_STATUS_NONE UINT8_MAX
+
+// Time for both ends to settle on a new UART rate
+#define ESB_DFU_BAUD_SETTLE_MS 2
+
+// Largest chunk that fits one UART frame and the TX queue
+static size_t esb_dfu_chunk_size(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+
+    return MIN(MIN(CONFIG_ZMK_ESB_DFU_CHUNK_SIZE,
+                   UINT8_MAX - sizeof(struct esb_dfu_chunk_header)),
+               config->tx_queue_size - ESB_DFU_OVERHEAD);
+}
+
+void esb_dfu_handle_baud(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_ctrl_baud *baud = (const void *)payload;
+
+    if (len < sizeof(*baud) || !atomic_get(&data->dfu.active)) {
+        return;
+    }
+
+    data->dfu.baudrate = sys_le32_to_cpu(baud->baudrate);
+    k_sem_give(&data->dfu.status);
+}
+
+void esb_dfu_handle_status(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_evt_dfu_status *evt = (const void *)payload;
+
+    if (len < sizeof(*evt) || !atomic_get(&data->dfu.active)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->dfu.lock);
+    data->dfu.acked = sys_le32_to_cpu(evt->offset);
+    data->dfu.last_status = evt->status;
+    if (evt->status == ESB_DFU_STATUS_RESEND) {
+        data->dfu.resend = true;
+    }
+    k_spin_unlock(&data->dfu.lock, key);
+
+    k_sem_give(&data->dfu.status);
+}
+
+// Wait until every queued byte, HID frames included, has left the UART
+static int esb_dfu_drain(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    const struct esb_transport_data *data = dev->data;
+    int64_t deadline = k_uptime_get() + CONFIG_ZMK_ESB_DFU_TIMEOUT_MS;
+
+    while (data->hid.count > 0 || esb_transport_tx_pending(dev) > 0 ||
+           uart_irq_tx_complete(config->uart) == 0) {
+        if (k_uptime_get() > deadline) {
+            return -ETIMEDOUT;
+        }
+        k_sleep(K_MSEC(1));
+    }
+
+    return 0;
+}
+
+// Wait for the next BLESB answer and return its status
+static int esb_dfu_wait(const struct device *dev, k_timeout_t timeout, uint8_t *status) {
+    struct esb_transport_data *data = dev->data;
+
+    if (k_sem_take(&data->dfu.status, timeout) != 0) {
+        return -ETIMEDOUT;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->dfu.lock);
+    *status = data->dfu.last_status;
+    k_spin_unlock(&data->dfu.lock, key);
+    return 0;
+}
+
+// Propose a UART rate and switch to whatever BLESB accepts
+static int esb_dfu_set_baud(const struct device *dev, uint32_t baudrate) {
+    struct esb_transport_data *data = dev->data;
+    struct esb_ctrl_baud req = {
+        .baudrate = sys_cpu_to_le32(baudrate),
+    };
+
+    data->dfu.baudrate = 0;
+    k_sem_reset(&data->dfu.status);
+
+    int err = esb_transport_send_ctrl(dev, ESB_CTRL_BAUD, &req, sizeof(req), ESB_DFU_TIMEOUT);
+    if (err) {
+        return err;
+    }
+
+    if (k_sem_take(&data->dfu.status, ESB_DFU_TIMEOUT) != 0) {
+        return -ETIMEDOUT;
+    }
+
+    if (data->dfu.baudrate == 0) {
+        return -ENOTSUP;
+    }
+
+    err = esb_dfu_drain(dev);
+    if (!err) {
+        err = esb_transport_set_baud(dev, data->dfu.baudrate);
+    }
+
+    k_sleep(K_MSEC(ESB_DFU_BAUD_SETTLE_MS));
+    return err;
+}
+
+static int esb_dfu_begin(const struct device *dev, const struct zmk_esb_dfu_image *image) {
+    struct esb_transport_data *data = dev->data;
+    struct esb_ctrl_dfu_start start = {
+        .image_size = sys_cpu_to_le32(image->size),
+        .image_crc = sys_cpu_to_le32(image->crc),
+    };
+    uint8_t status;
+
+    k_spinlock_key_t key = k_spin_lock(&data->dfu.lock);
+    data->dfu.size = image->size;
+    data->dfu.acked = 0;
+    data->dfu.last_status = ESB_DFU_STATUS_NONE;
+    data->dfu.resend = false;
+    k_spin_unlock(&data->dfu.lock, key);
+    k_sem_reset(&data->dfu.status);
+
+    int err = esb_transport_send_ctrl(dev, ESB_CTRL_DFU_START, &start, sizeof(start),
+                                      ESB_DFU_TIMEOUT);
+    if (err) {
+        return err;
+    }
+
+    // BLESB may erase its update slot before answering
+    err = esb_dfu_wait(dev, K_MSEC(CONFIG_ZMK_ESB_DFU_ERASE_TIMEOUT_MS), &status);
+    if (err) {
+        return err;
+    }
+
+    if (status != ESB_DFU_STATUS_OK || data->dfu.acked > image->size) {
+        return -EIO;
+    }
+
+    if (data->dfu.acked > 0) {
+        LOG_INF("Resuming BLESB update at %u of %u bytes", data->dfu.acked, image->size);
+    }
+
+    return 0;
+}
+
+// Keep a window of chunks in flight and go back to the last acknowledged
+// offset on a resend request or when BLESB stays silent
+static int esb_dfu_stream(const struct device *dev, const struct zmk_esb_dfu_image *image) {
+    struct esb_transport_data *data = dev->data;
+    uint8_t frame[sizeof(struct hid_packet_header) + UINT8_MAX];
+    struct hid_packet_header *header = (struct hid_packet_header *)frame;
+    struct esb_dfu_chunk_header *chunk =
+        (struct esb_dfu_chunk_header *)&frame[sizeof(*header)];
+    uint8_t *body = &frame[ESB_DFU_OVERHEAD];
+    size_t chunk_size = esb_dfu_chunk_size(dev);
+    uint32_t window = chunk_size * CONFIG_ZMK_ESB_DFU_WINDOW;
+    uint32_t sent = data->dfu.acked;
+    uint32_t progress = data->dfu.acked;
+    int retries = 0;
+
+    while (true) {
+        k_spinlock_key_t key = k_spin_lock(&data->dfu.lock);
+        uint32_t acked = data->dfu.acked;
+        uint8_t status = data->dfu.last_status;
+        bool resend = data->dfu.resend;
+        data->dfu.resend = false;
+        k_spin_unlock(&data->dfu.lock, key);
+
+        if (status == ESB_DFU_STATUS_ERROR) {
+            return -EIO;
+        }
+
+        if (acked >= image->size) {
+            return 0;
+        }
+
+        if (resend || sent < acked) {
+            sent = acked;
+        }
+
+        if (acked > progress) {
+            progress = acked;
+            retries = 0;
+        }
+
+        while (sent < image->size && sent - acked < window) {
+            size_t len = MIN(chunk_size, image->size - sent);
+
+            int err = image->read(sent, body, len, image->user_data);
+            if (err) {
+                return err;
+            }
+
+            header->type = ESB_FRAME_DFU_DATA;
+            header->length = sizeof(*chunk) + len;
+            chunk->offset = sys_cpu_to_le32(sent);
+            chunk->crc = sys_cpu_to_le32(crc32_ieee(body, len));
+
+            err = esb_transport_tx(dev, frame, ESB_DFU_OVERHEAD + len, ESB_DFU_TIMEOUT);
+            if (err) {
+                return err;
+            }
+
+            sent += len;
+        }
+
+        if (k_sem_take(&data->dfu.status, ESB_DFU_TIMEOUT) != 0) {
+            if (++retries > CONFIG_ZMK_ESB_DFU_RETRIES) {
+                return -ETIMEDOUT;
+            }
+
+            LOG_DBG("BLESB update stalled, resending from %u", acked);
+            sent = acked;
+        }
+    }
+}
+
+static int esb_dfu_finish(const struct device *dev) {
+    uint8_t status;
+
+    int err = esb_transport_send_ctrl(dev, ESB_CTRL_DFU_FINISH, NULL, 0, ESB_DFU_TIMEOUT);
+    if (err) {
+        return err;
+    }
+
+    // Late acknowledgements may still be on their way
+    do {
+        err = esb_dfu_wait(dev, K_MSEC(CONFIG_ZMK_ESB_DFU_ERASE_TIMEOUT_MS), &status);
+    } while (!err && status == ESB_DFU_STATUS_OK);
+
+    if (err) {
+        return err;
+    }
+
+    return status == ESB_DFU_STATUS_DONE ? 0 : -EIO;
+}
+
+void esb_dfu_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_sem_init(&data->dfu.status, 0, 1);
+    atomic_set(&data->dfu.active, 0);
+}
+
+int zmk_esb_dfu_update(const struct zmk_esb_dfu_image *image) {
+    const struct device *dev = esb_transport_default();
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    uint32_t base_baud = 0;
+    bool raised = false;
+
+    if (image == NULL || image->read == NULL || image->size == 0) {
+        return -EINVAL;
+    }
+
+    if (!esb_transport_is_connected(dev)) {
+        return -ENOTCONN;
+    }
+
+    if (!atomic_cas(&data->dfu.active, 0, 1)) {
+        return -EBUSY;
+    }
+
+    LOG_INF("Updating BLESB firmware: %u bytes", image->size);
+
+    esb_power_dfu_hold(dev, true);
+
+    // The link belongs to the update until BLESB confirms ESB mode again, so
+    // ZMK moves to another endpoint meanwhile
+    esb_transport_set_connected(dev, false);
+
+    int err = esb_dfu_drain(dev);
+
+    if (!err && config->dfu_baud != 0 && esb_transport_get_baud(dev, &base_baud) == 0 &&
+        config->dfu_baud > base_baud) {
+        int baud_err = esb_dfu_set_baud(dev, config->dfu_baud);
+        if (baud_err) {
+            LOG_WRN("BLESB update stays at %u baud (%d)", base_baud, baud_err);
+        } else {
+            LOG_INF("BLESB update at %u baud", data->dfu.baudrate);
+        }
+        raised = !baud_err;
+    }
+
+    if (!err) {
+        err = esb_dfu_begin(dev, image);
+    }
+    if (!err) {
+        err = esb_dfu_stream(dev, image);
+    }
+    if (!err) {
+        err = esb_dfu_finish(dev);
+    }
+
+    if (err) {
+        LOG_ERR("BLESB update failed at %u of %u bytes (%d)", data->dfu.acked, image->size, err);
+        if (raised && esb_dfu_set_baud(dev, base_baud) != 0) {
+            // BLESB falls back on its own after a second of silence
+            esb_dfu_drain(dev);
+        }
+    } else {
+        LOG_INF("BLESB update complete - waiting for it to restart");
+    }
+
+    // BLESB restarts at its base rate with possibly different capabilities
+    if (raised) {
+        esb_dfu_drain(dev);
+        esb_transport_set_baud(dev, base_baud);
+    }
+    data->max_payload = MIN(config->max_payload, ESB_PAYLOAD_LEGACY);
+    data->caps = 0;
+
+    // The query below keeps the UART until it has left
+    esb_power_tx_get(dev);
+    esb_power_dfu_hold(dev, false);
+    atomic_set(&data->dfu.active, 0);
+    esb_transport_probe(dev);
+    return err;
+}
+
+int zmk_esb_dfu_get_progress(uint32_t *done, uint32_t *total) {
+    struct esb_transport_data *data = esb_transport_default()->data;
+
+    if (!atomic_get(&data->dfu.active)) {
+        return -ENODATA;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->dfu.lock);
+    *done = MIN(data->dfu.acked, data->dfu.size);
+    *total = data->dfu.size;
+    k_spin_unlock(&data->dfu.lock, key);
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_FLASH_MAP)
+static int esb_dfu_flash_read(uint32_t offset, uint8_t *buf, size_t len, void *user_data) {
+    return flash_area_read(user_data, offset, buf, len);
+}
+
+int zmk_esb_dfu_update_from_flash(uint8_t area_id, size_t size) {
+    const struct flash_area *fa;
+    uint8_t buf[64];
+    uint32_t crc = 0;
+
+    int err = flash_area_open(area_id, &fa);
+    if (err) {
+        return err;
+    }
+
+    if (size == 0 || size > fa->fa_size) {
+        flash_area_close(fa);
+        return -EINVAL;
+    }
+
+    for (size_t offset = 0; offset < size; offset += sizeof(buf)) {
+        size_t len = MIN(sizeof(buf), size - offset);
+
+        err = flash_area_read(fa, offset, buf, len);
+        if (err) {
+            flash_area_close(fa);
+            return err;
+        }
+
+        crc = crc32_ieee_update(crc, buf, len);
+    }
+
+    struct zmk_esb_dfu_image image = {
+        .size = size,
+        .crc = crc,
+        .read = esb_dfu_flash_read,
+        .user_data = (void *)fa,
+    };
+
+    err = zmk_esb_dfu_update(&image);
+    flash_area_close(fa);
+    return err;
+}
+#endif
@@ -0,0 +1,253 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define ESB_FRAG_OVERHEAD (sizeof(struct hid_packet_header) + sizeof(struct esb_frag_header))
+
+static zmk_esb_message_callback_t esb_message_callback;
+
+static bool esb_frag_is_message(uint8_t type) {
+    return type == ZMK_ESB_MESSAGE_HID_DESCRIPTOR || type == ZMK_ESB_MESSAGE_VENDOR;
+}
+
+uint8_t esb_frag_next_id(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    return (uint8_t)atomic_inc(&data->frag.tx_msg_id);
+}
+
+// Returns -EINVAL when a payload has no room left after the fragment headers
+int esb_frag_count(const struct device *dev, size_t payload_len) {
+    const struct esb_transport_data *data = dev->data;
+
+    if (data->max_payload <= ESB_FRAG_OVERHEAD) {
+        return -EINVAL;
+    }
+
+    return DIV_ROUND_UP(1 + payload_len, data->max_payload - ESB_FRAG_OVERHEAD);
+}
+
+// Fragments carry slices of the message [type][payload...]. Returns the frame
+// length, or -EINVAL for an index past the last fragment.
+int esb_frag_build(const struct device *dev, uint8_t *out, uint8_t msg_id, uint8_t index,
+                   uint8_t type, const uint8_t *payload, size_t payload_len) {
+    const struct esb_transport_data *data = dev->data;
+    int count = esb_frag_count(dev, payload_len);
+
+    if (count < 0 || index >= count) {
+        return -EINVAL;
+    }
+
+    size_t chunk = data->max_payload - ESB_FRAG_OVERHEAD;
+    size_t start = index * chunk;
+    size_t len = MIN(chunk, 1 + payload_len - start);
+
+    struct hid_packet_header *header = (struct hid_packet_header *)out;
+    struct esb_frag_header *frag = (struct esb_frag_header *)&out[sizeof(*header)];
+    uint8_t *body = &out[ESB_FRAG_OVERHEAD];
+
+    header->type = ESB_FRAME_FRAGMENT;
+    header->length = sizeof(*frag) + len;
+    frag->msg_id = msg_id;
+    frag->index = index;
+    frag->count = count;
+
+    if (index == 0) {
+        body[0] = type;
+        memcpy(&body[1], payload, len - 1);
+    } else {
+        memcpy(body, &payload[start - 1], len);
+    }
+
+    return ESB_FRAG_OVERHEAD + len;
+}
+
+// Send a message of any size, fragmented when it exceeds one ESB payload.
+// Fragments follow each other without waiting for BLESB, but only one payload
+// is queued ahead of the wire at a time so HID frames can slip in between.
+int esb_frag_send(const struct device *dev, uint8_t type, const uint8_t *payload, size_t len) {
+    struct esb_transport_data *data = dev->data;
+    uint8_t frame[sizeof(struct hid_packet_header) + UINT8_MAX];
+
+    if (sizeof(struct hid_packet_header) + len <= data->max_payload) {
+        return esb_transport_send_ctrl(dev, type, payload, len, K_FOREVER);
+    }
+
+    int count = esb_frag_count(dev, len);
+    if (count < 0) {
+        return count;
+    }
+    if (!(data->caps & ESB_CAPS_FRAGMENT) || count > UINT8_MAX) {
+        return -EMSGSIZE;
+    }
+
+    esb_power_activity(dev, false);
+
+    uint8_t msg_id = esb_frag_next_id(dev);
+
+    for (int i = 0; i < count; i++) {
+        while (esb_transport_tx_pending(dev) >= data->max_payload) {
+            k_sem_take(&data->tx_space, K_FOREVER);
+        }
+
+        int frame_len = esb_frag_build(dev, frame, msg_id, i, type, payload, len);
+        if (frame_len < 0) {
+            return frame_len;
+        }
+
+        int err = esb_transport_tx(dev, frame, frame_len, K_FOREVER);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+static void esb_frag_rx_reset(struct esb_transport_data *data) {
+    data->frag.rx_len = 0;
+    data->frag.rx_next = 0;
+    data->frag.rx_active = false;
+}
+
+static void esb_frag_timeout_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, frag.timeout_work);
+
+    if (data->frag.rx_active) {
+        LOG_WRN("ESB message %d timed out after %d/%d fragments", data->frag.rx_msg_id,
+                data->frag.rx_next, data->frag.rx_count);
+        esb_frag_rx_reset(data);
+    }
+}
+
+// Messages are delivered from the system workqueue rather than the UART ISR
+static void esb_frag_deliver_work(struct k_work *work) {
+    struct esb_transport_data *data = CONTAINER_OF(work, struct esb_transport_data, frag.rx_work);
+
+    if (esb_message_callback) {
+        esb_message_callback(data->frag.rx_buf[0], &data->frag.rx_buf[1], data->frag.rx_len - 1);
+    }
+
+    data->frag.rx_ready = false;
+}
+
+void esb_frag_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_work_init_delayable(&data->frag.timeout_work, esb_frag_timeout_work);
+    k_work_init(&data->frag.rx_work, esb_frag_deliver_work);
+    data->frag.rx_ready = false;
+    esb_frag_rx_reset(data);
+}
+
+// Frames that carry other frames are never fragmented themselves; dispatching
+// one would reassemble into the buffer it is read from
+static bool esb_frag_is_container(uint8_t type) {
+    return type == ESB_FRAME_FRAGMENT || type == ESB_FRAME_BATCH ||
+           type == ESB_FRAME_BULK_DATA || type == ESB_FRAME_BULK_ACK;
+}
+
+static void esb_frag_complete(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+    uint8_t type = data->frag.rx_buf[0];
+    size_t len = data->frag.rx_len - 1;
+
+    k_work_cancel_delayable(&data->frag.timeout_work);
+    data->frag.rx_active = false;
+
+    if (esb_frag_is_message(type)) {
+        data->frag.rx_ready = true;
+        k_work_submit(&data->frag.rx_work);
+        return;
+    }
+
+    data->frag.rx_len = 0;
+
+    if (esb_frag_is_container(type)) {
+        LOG_WRN("Dropped reassembled BLESB frame 0x%02x", type);
+        return;
+    }
+
+    if (len > UINT8_MAX) {
+        LOG_WRN("Reassembled BLESB frame 0x%02x too large: %zu bytes", type, len);
+        return;
+    }
+
+    esb_transport_handle_frame(dev, type, &data->frag.rx_buf[1], len);
+}
+
+void esb_frag_handle(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_frag_header *frag = (const void *)payload;
+
+    if (len < sizeof(*frag) || frag->index >= frag->count) {
+        return;
+    }
+
+    const uint8_t *body = &payload[sizeof(*frag)];
+    size_t body_len = len - sizeof(*frag);
+
+    // The buffer still holds a message waiting for delivery
+    if (data->frag.rx_ready) {
+        LOG_WRN("ESB reassembly busy, dropped message %d", frag->msg_id);
+        return;
+    }
+
+    if (frag->index == 0) {
+        if (data->frag.rx_active) {
+            LOG_WRN("ESB message %d superseded by %d", data->frag.rx_msg_id, frag->msg_id);
+        }
+        esb_frag_rx_reset(data);
+        data->frag.rx_active = true;
+        data->frag.rx_msg_id = frag->msg_id;
+        data->frag.rx_count = frag->count;
+    } else if (!data->frag.rx_active || frag->msg_id != data->frag.rx_msg_id ||
+               frag->index != data->frag.rx_next) {
+        // Out of order or unknown message, the sender has moved on
+        return;
+    }
+
+    if (data->frag.rx_len + body_len > sizeof(data->frag.rx_buf)) {
+        LOG_WRN("ESB message %d exceeds the reassembly buffer", frag->msg_id);
+        esb_frag_rx_reset(data);
+        return;
+    }
+
+    memcpy(&data->frag.rx_buf[data->frag.rx_len], body, body_len);
+    data->frag.rx_len += body_len;
+    data->frag.rx_next++;
+
+    if (data->frag.rx_next == data->frag.rx_count) {
+        esb_frag_complete(dev);
+    } else {
+        k_work_reschedule(&data->frag.timeout_work,
+                          K_MSEC(CONFIG_ZMK_ESB_REASSEMBLY_TIMEOUT_MS));
+    }
+}
+
+int zmk_esb_send_message(enum zmk_esb_message_type type, const uint8_t *data, size_t len) {
+    const struct device *dev = esb_transport_default();
+
+    if (!esb_frag_is_message(type) || (data == NULL && len > 0)) {
+        return -EINVAL;
+    }
+
+    if (!esb_transport_is_connected(dev)) {
+        return -ENOTCONN;
+    }
+
+    return esb_frag_send(dev, type, data, len);
+}
+
+void zmk_esb_set_message_callback(zmk_esb_message_callback_t callback) {
+    esb_message_callback = callback;
+}
@@ -1,88 +1,901 @@
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
-#include <zephyr/drivers/uart.h>
 #include <zephyr/logging/log.h>
 
 #include <zmk/hid.h>
+#if IS_ENABLED(CONFIG_ZMK_HID_INDICATORS)
+#include <zmk/endpoints_types.h>
+#include <zmk/hid_indicators.h>
+#endif
 #include <zmk_feature_esb_transport/esb.h>
 #include <zmk_feature_esb_transport/esb_hid.h>
+#include <zmk_feature_esb_transport/events/esb_tx_space_available.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
-// UART device for HID data transmission
-static const struct device *esb_uart_dev;
+// Priority lane of a queued frame type, ESB_LANE_KEYBOARD first
+static uint8_t esb_hid_lane(uint8_t type) {
+    switch (type) {
+    case HID_PACKET_TYPE_KEYBOARD:
+    case ESB_FRAME_SEQUENCED:
+        return ESB_LANE_KEYBOARD;
+    case HID_PACKET_TYPE_CONSUMER:
+        return ESB_LANE_CONSUMER;
+    default:
+        return ESB_LANE_MOUSE;
+    }
+}
 
-// HID packet header structure
-struct hid_packet_header {
-    uint8_t type;      // 1=keyboard, 2=consumer, 3=mouse
-    uint8_t length;    // HID report data length
-} __packed;
+static struct esb_frame *esb_hid_lane_head(const struct device *dev, uint8_t lane) {
+    const struct esb_transport_config *config = dev->config;
+    const struct esb_transport_data *data = dev->data;
 
-// HID packet types
-#define HID_PACKET_TYPE_KEYBOARD 1
-#define HID_PACKET_TYPE_CONSUMER 2
-#define HID_PACKET_TYPE_MOUSE    3
+    return &config->frames[data->hid.lanes[lane].head];
+}
 
-// Send HID report with header in SINGLE packet - much simpler for BLESB
-static int zmk_esb_hid_send_report(uint8_t type, const uint8_t *report, size_t len) {
-    if (!zmk_esb_active_profile_is_connected()) {
-        return -ENOTCONN;
+// Lane to take the next frame from: the one being fragmented, else one passed
+// over CONFIG_ZMK_ESB_LANE_STARVATION_LIMIT times, else the highest priority
+static uint8_t esb_hid_pick(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+    int8_t pick = -1;
+
+    if (data->hid.frag_index > 0) {
+        return data->hid.frag_lane;
     }
-    
-    if (!esb_uart_dev || !device_is_ready(esb_uart_dev)) {
+
+    for (uint8_t lane = 0; lane < ESB_LANE_COUNT; lane++) {
+        if (data->hid.lanes[lane].head == ESB_FRAME_NONE) {
+            continue;
+        }
+
+        if (pick < 0) {
+            pick = lane;
+        }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+        if (lane == ESB_LANE_RESYNC) {
+            continue;
+        }
+#endif
+
+        if (CONFIG_ZMK_ESB_LANE_STARVATION_LIMIT > 0 &&
+            data->hid.lanes[lane].passed >= CONFIG_ZMK_ESB_LANE_STARVATION_LIMIT) {
+            return lane;
+        }
+    }
+
+    return pick;
+}
+
+// Take a free slot and append it to a lane; the caller fills it in
+static struct esb_frame *esb_hid_frame_push(const struct device *dev, uint8_t lane) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    uint8_t slot = data->hid.free;
+    struct esb_frame *frame = &config->frames[slot];
+
+    data->hid.free = frame->next;
+    frame->next = ESB_FRAME_NONE;
+
+    if (data->hid.lanes[lane].head == ESB_FRAME_NONE) {
+        data->hid.lanes[lane].head = slot;
+    } else {
+        config->frames[data->hid.lanes[lane].tail].next = slot;
+    }
+    data->hid.lanes[lane].tail = slot;
+    data->hid.count++;
+
+    return frame;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+// With idle resync, state is repeated on its schedule anyway
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+#define ESB_HID_DUPLICATE_REFRESH_MS CONFIG_ZMK_ESB_RESYNC_PERIOD_MS
+#else
+#define ESB_HID_DUPLICATE_REFRESH_MS CONFIG_ZMK_ESB_DUPLICATE_REFRESH_MS
+#endif
+
+// Called with the HID queue locked
+static void esb_hid_remember(struct esb_transport_data *data, uint8_t type, const uint8_t *report,
+                             size_t len) {
+    if (type < 1 || type > ZMK_ESB_REPORT_TYPE_COUNT || len > ESB_HID_REPORT_MAX) {
+        return;
+    }
+
+    memcpy(data->hid.last[type - 1], report, len);
+    data->hid.last_len[type - 1] = len;
+    data->hid.last_time[type - 1] = k_uptime_get_32();
+}
+
+// Called with the HID queue locked once a payload is on the UART queue: note
+// each report it carries as sent. Fragmented reports are not remembered.
+static void esb_hid_remember_payload(struct esb_transport_data *data, const uint8_t *buf,
+                                     size_t len) {
+    const struct hid_packet_header *header = (const void *)buf;
+    const uint8_t *body = &buf[sizeof(*header)];
+
+    switch (header->type) {
+    case ESB_FRAME_BATCH:
+        for (size_t off = sizeof(*header); off + sizeof(*header) <= len;
+             off += sizeof(*header) + buf[off + 1]) {
+            esb_hid_remember_payload(data, &buf[off], len - off);
+        }
+        break;
+    case ESB_FRAME_SEQUENCED: {
+        const struct esb_seq_header *seq = (const void *)body;
+
+        esb_hid_remember(data, seq->type, &body[sizeof(*seq)], header->length - sizeof(*seq));
+        break;
+    }
+    case ESB_FRAME_TIMED: {
+        const struct esb_timed_header *timed = (const void *)body;
+
+        esb_hid_remember(data, timed->type, &body[sizeof(*timed)],
+                         header->length - sizeof(*timed));
+        break;
+    }
+    default:
+        esb_hid_remember(data, header->type, body, header->length);
+        break;
+    }
+}
+
+// A report identical to the last one of its type handed to the UART is
+// skipped, unless that went out more than ESB_HID_DUPLICATE_REFRESH_MS ago.
+// Mouse reports only repeat state when they carry no motion.
+static bool esb_hid_duplicate(const struct device *dev, uint8_t type, const uint8_t *report,
+                              size_t len) {
+    struct esb_transport_data *data = dev->data;
+    bool duplicate = false;
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    if (type == HID_PACKET_TYPE_MOUSE) {
+        const struct zmk_hid_mouse_report *mouse = (const void *)report;
+
+        if (mouse->body.d_x != 0 || mouse->body.d_y != 0 || mouse->body.d_scroll_x != 0 ||
+            mouse->body.d_scroll_y != 0) {
+            return false;
+        }
+    }
+#endif
+
+    k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+
+    duplicate = data->hid.last_len[type - 1] == len &&
+                memcmp(data->hid.last[type - 1], report, len) == 0 &&
+                k_uptime_get_32() - data->hid.last_time[type - 1] < ESB_HID_DUPLICATE_REFRESH_MS;
+
+    k_spin_unlock(&data->hid.lock, key);
+
+    if (duplicate) {
+        atomic_inc(&data->hid.suppressed);
+    }
+    return duplicate;
+}
+
+// The dongle's state is unknown after (re)connecting: send everything again
+void esb_hid_forget(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+    memset(data->hid.last_len, 0, sizeof(data->hid.last_len));
+    k_spin_unlock(&data->hid.lock, key);
+}
+#endif
+
+// Return a slot already taken off its lane to the free list
+static void esb_hid_frame_free(const struct device *dev, uint8_t slot) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    config->frames[slot].next = data->hid.free;
+    data->hid.free = slot;
+    data->hid.count--;
+
+    k_sem_give(&data->hid.space);
+    if (atomic_get(&data->hid.blocked) != 0) {
+        k_work_submit(&data->hid.space_work);
+    }
+}
+
+// Return a lane's head frame to the free list
+static void esb_hid_frame_unlink(const struct device *dev, uint8_t lane) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    uint8_t slot = data->hid.lanes[lane].head;
+
+    data->hid.lanes[lane].head = config->frames[slot].next;
+    esb_hid_frame_free(dev, slot);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+// Called with the HID queue locked. A live report supersedes the snapshots of
+// its type still waiting in the resync lane.
+static void esb_hid_drop_resync(const struct device *dev, uint8_t type) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    uint8_t *link = &data->hid.lanes[ESB_LANE_RESYNC].head;
+    uint8_t prev = ESB_FRAME_NONE;
+
+    // A head going out in fragments has to finish
+    if (data->hid.frag_index > 0 && data->hid.frag_lane == ESB_LANE_RESYNC) {
+        prev = *link;
+        link = &config->frames[prev].next;
+    }
+
+    while (*link != ESB_FRAME_NONE) {
+        uint8_t slot = *link;
+        struct esb_frame *frame = &config->frames[slot];
+
+        if (frame->data[0] != type) {
+            prev = slot;
+            link = &frame->next;
+            continue;
+        }
+
+        *link = frame->next;
+        if (data->hid.lanes[ESB_LANE_RESYNC].tail == slot) {
+            data->hid.lanes[ESB_LANE_RESYNC].tail = prev;
+        }
+        esb_hid_frame_free(dev, slot);
+    }
+}
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING) && CONFIG_ZMK_ESB_MOUSE_DEADLINE_US > 0
+static bool esb_hid_mouse_expired(const struct esb_frame *frame, uint32_t now) {
+    return frame->data[0] == HID_PACKET_TYPE_MOUSE &&
+           now - frame->stamp > k_us_to_cyc_ceil32(CONFIG_ZMK_ESB_MOUSE_DEADLINE_US);
+}
+
+// Fold mouse frames queued past their deadline into the next mouse frame, so
+// a backlog of motion is delivered late once instead of frame by frame.
+// Frames whose buttons differ from the next one are never folded.
+static void esb_hid_fold_expired(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    uint32_t now = k_cycle_get_32();
+
+    if (data->hid.frag_index > 0 && data->hid.frag_lane == ESB_LANE_MOUSE) {
+        return;
+    }
+
+    while (data->hid.lanes[ESB_LANE_MOUSE].head != ESB_FRAME_NONE) {
+        struct esb_frame *frame = esb_hid_lane_head(dev, ESB_LANE_MOUSE);
+
+        if (!esb_hid_mouse_expired(frame, now) || frame->next == ESB_FRAME_NONE) {
+            return;
+        }
+
+        struct esb_frame *next = &config->frames[frame->next];
+        const struct zmk_hid_mouse_report *stale =
+            (const void *)&frame->data[sizeof(struct hid_packet_header)];
+        struct zmk_hid_mouse_report *fresh = (void *)&next->data[sizeof(struct hid_packet_header)];
+
+        if (next->data[0] != HID_PACKET_TYPE_MOUSE ||
+            stale->body.buttons != fresh->body.buttons) {
+            return;
+        }
+
+        esb_rate_mouse_merge(fresh, stale);
+        atomic_inc(&data->rate.merged);
+        atomic_inc(&data->rate.expired);
+        esb_hid_frame_unlink(dev, ESB_LANE_MOUSE);
+    }
+}
+#endif
+
+static void esb_hid_frame_pop(const struct device *dev, uint8_t lane) {
+    struct esb_transport_data *data = dev->data;
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING) && CONFIG_ZMK_ESB_MOUSE_DEADLINE_US > 0
+    // Sent anyway as nothing newer could take it in
+    if (lane == ESB_LANE_MOUSE &&
+        esb_hid_mouse_expired(esb_hid_lane_head(dev, lane), k_cycle_get_32())) {
+        atomic_inc(&data->rate.expired);
+    }
+#endif
+
+    esb_hid_frame_unlink(dev, lane);
+
+    // Lower lanes left waiting move closer to their guaranteed turn
+    data->hid.lanes[lane].passed = 0;
+    for (uint8_t lower = lane + 1; lower < ESB_LANE_COUNT; lower++) {
+        if (data->hid.lanes[lower].head != ESB_FRAME_NONE) {
+            data->hid.lanes[lower].passed++;
+        }
+    }
+}
+
+// A frame leaves the queue for the UART
+static void esb_hid_note_sent(const struct device *dev, const struct esb_frame *frame) {
+    struct esb_transport_data *data = dev->data;
+
+    atomic_inc(&data->stats.frames);
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+    esb_hist_record(dev, esb_hist_frame_type(frame->data), ZMK_ESB_HIST_QUEUE,
+                    k_cycle_get_32() - frame->stamp);
+#endif
+}
+
+// Emit the next fragment of a head frame larger than one ESB payload
+static size_t esb_hid_pack_fragment(const struct device *dev, uint8_t lane, uint8_t *out) {
+    struct esb_transport_data *data = dev->data;
+    struct esb_frame *frame = esb_hid_lane_head(dev, lane);
+    const uint8_t *payload = &frame->data[sizeof(struct hid_packet_header)];
+    size_t payload_len = frame->len - sizeof(struct hid_packet_header);
+
+    if (data->hid.frag_index == 0) {
+        data->hid.frag_msg_id = esb_frag_next_id(dev);
+        data->hid.frag_lane = lane;
+    }
+
+    int len = esb_frag_build(dev, out, data->hid.frag_msg_id, data->hid.frag_index,
+                             frame->data[0], payload, payload_len);
+
+    // Cannot be split at the current payload size: drop the frame
+    if (len < 0) {
+        LOG_WRN("Dropped ESB frame 0x%02x, cannot fragment (%d)", frame->data[0], len);
+        atomic_inc(&data->stats.dropped);
+        data->hid.frag_index = 0;
+        esb_hid_frame_pop(dev, lane);
+        return 0;
+    }
+
+    if (++data->hid.frag_index == esb_frag_count(dev, payload_len)) {
+        data->hid.frag_index = 0;
+        esb_hid_note_sent(dev, frame);
+        esb_hid_frame_pop(dev, lane);
+    }
+
+    return len;
+}
+
+// Pop queued frames in lane order into one ESB payload, batching them when
+// BLESB supports it
+static size_t esb_hid_pack(const struct device *dev, uint8_t *out) {
+    struct esb_transport_data *data = dev->data;
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING) && CONFIG_ZMK_ESB_MOUSE_DEADLINE_US > 0
+    esb_hid_fold_expired(dev);
+#endif
+
+    uint8_t lane = esb_hid_pick(dev);
+    struct esb_frame *frame = esb_hid_lane_head(dev, lane);
+
+    if (data->hid.frag_index > 0 || frame->len > data->max_payload) {
+        return esb_hid_pack_fragment(dev, lane, out);
+    }
+
+    bool batch = (data->caps & ESB_CAPS_BATCH) && data->hid.count > 1 &&
+                 sizeof(struct hid_packet_header) + frame->len <= data->max_payload;
+
+    if (!batch) {
+        size_t len = 0;
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIMING)
+        len = esb_timing_pack(dev, frame, out);
+#endif
+        if (len == 0) {
+            len = frame->len;
+            memcpy(out, frame->data, len);
+        }
+        esb_hid_note_sent(dev, frame);
+        esb_hid_frame_pop(dev, lane);
+        return len;
+    }
+
+    size_t off = sizeof(struct hid_packet_header);
+    int frames = 0;
+
+    while (data->hid.count > 0) {
+        lane = esb_hid_pick(dev);
+        frame = esb_hid_lane_head(dev, lane);
+        if (off + frame->len > data->max_payload) {
+            break;
+        }
+
+        memcpy(&out[off], frame->data, frame->len);
+        off += frame->len;
+        frames++;
+        esb_hid_note_sent(dev, frame);
+        esb_hid_frame_pop(dev, lane);
+    }
+
+    // Nothing joined the first frame after all
+    if (frames == 1) {
+        memmove(out, &out[sizeof(struct hid_packet_header)],
+                off - sizeof(struct hid_packet_header));
+        return off - sizeof(struct hid_packet_header);
+    }
+
+    struct hid_packet_header *header = (struct hid_packet_header *)out;
+    header->type = ESB_FRAME_BATCH;
+    header->length = off - sizeof(struct hid_packet_header);
+    return off;
+}
+
+// Move queued frames to the UART, keeping at most one payload ahead of the wire
+// so frames arriving meanwhile can still be batched together. With poll
+// alignment, frames may instead wait for the release point of the next poll.
+static void esb_hid_drain(const struct device *dev, bool aligned) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+
+    while (data->hid.count > 0 && esb_transport_tx_pending(dev) < data->max_payload &&
+           !esb_power_hold(dev) && !(aligned && esb_sync_hold(dev))) {
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+        // Bulk shares the lowest lane: it gets one payload in after being
+        // passed over by the starvation limit
+        if (CONFIG_ZMK_ESB_LANE_STARVATION_LIMIT > 0 &&
+            data->hid.bulk_passed >= CONFIG_ZMK_ESB_LANE_STARVATION_LIMIT) {
+            size_t len = esb_bulk_pack(dev, config->batch_buf);
+
+            data->hid.bulk_passed = 0;
+            if (len > 0) {
+                esb_transport_tx(dev, config->batch_buf, len, K_NO_WAIT);
+                continue;
+            }
+        }
+#endif
+
+        size_t len = esb_hid_pack(dev, config->batch_buf);
+        if (len == 0) {
+            continue;
+        }
+
+        int err = esb_transport_tx(dev, config->batch_buf, len, K_NO_WAIT);
+        if (err) {
+            atomic_inc(&data->stats.dropped);
+            LOG_WRN("Dropped ESB HID payload (%d)", err);
+        } else {
+            esb_power_note_tx(dev);
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+            esb_hid_remember_payload(data, config->batch_buf, len);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+            esb_hist_note_payload(dev, config->batch_buf);
+#endif
+        }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+        if (esb_bulk_pending(dev)) {
+            data->hid.bulk_passed++;
+        }
+#endif
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    // Otherwise bulk only fills an idle wire: a keystroke arriving now waits
+    // behind at most the one bulk payload already queued. Like HID frames, it
+    // waits for BLESB to wake; the wake work flushes again.
+    while (data->hid.count == 0 && esb_transport_tx_pending(dev) < data->max_payload &&
+           !esb_power_hold(dev)) {
+        size_t len = esb_bulk_pack(dev, config->batch_buf);
+        if (len == 0) {
+            break;
+        }
+
+        data->hid.bulk_passed = 0;
+        esb_transport_tx(dev, config->batch_buf, len, K_NO_WAIT);
+    }
+#endif
+
+    k_spin_unlock(&data->hid.lock, key);
+}
+
+void esb_hid_flush(const struct device *dev) { esb_hid_drain(dev, true); }
+
+// Replace everything queued with frames that must go out first, such as the
+// release-all frames on link loss, and send them without waiting for a poll.
+// Safe from the UART ISR.
+void esb_hid_preempt(const struct device *dev, const struct esb_frame *frames, size_t count) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+
+    for (uint8_t lane = 0; lane < ESB_LANE_COUNT; lane++) {
+        while (data->hid.lanes[lane].head != ESB_FRAME_NONE) {
+            atomic_inc(&data->stats.dropped);
+            esb_hid_frame_pop(dev, lane);
+        }
+        data->hid.lanes[lane].passed = 0;
+    }
+    data->hid.frag_index = 0;
+
+    for (size_t i = 0; i < count && i < config->frame_queue_depth; i++) {
+        struct esb_frame *frame = esb_hid_frame_push(dev, esb_hid_lane(frames[i].data[0]));
+
+        frame->len = frames[i].len;
+        frame->stamp = k_cycle_get_32();
+        memcpy(frame->data, frames[i].data, frames[i].len);
+    }
+
+    k_spin_unlock(&data->hid.lock, key);
+
+    esb_hid_release(dev);
+}
+
+// Release point of a poll reached: send what is queued
+void esb_hid_release(const struct device *dev) { esb_hid_drain(dev, false); }
+
+static void esb_hid_flush_work(struct k_work *work) {
+    struct esb_transport_data *data = CONTAINER_OF(work, struct esb_transport_data, hid.flush_work);
+
+    esb_hid_flush(data->dev);
+}
+
+// Frames or bulk segments still waiting for UART queue space
+bool esb_hid_pending(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+    bool pending = data->hid.count > 0;
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    pending = pending || esb_bulk_pending(dev);
+#endif
+    return pending;
+}
+
+// Called from the UART ISR whenever it frees queue space
+void esb_hid_tx_ready(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    if (esb_hid_pending(dev)) {
+        k_work_submit(&data->hid.flush_work);
+    }
+}
+
+// Listeners expect thread context, not the UART ISR that freed the slot
+static void esb_hid_space_work(struct k_work *work) {
+    struct esb_transport_data *data = CONTAINER_OF(work, struct esb_transport_data, hid.space_work);
+    uint8_t types = (uint8_t)atomic_clear(&data->hid.blocked);
+
+    if (types != 0) {
+        raise_zmk_esb_tx_space_available(
+            (struct zmk_esb_tx_space_available){.report_types = types});
+    }
+}
+
+// Raise zmk_esb_tx_space_available for reports refused while nothing was
+// queued to free a slot, such as during a replay
+void esb_hid_notify_space(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    if (atomic_get(&data->hid.blocked) != 0) {
+        k_work_submit(&data->hid.space_work);
+    }
+}
+
+// A report was refused for lack of queue space. The caller resubmits the latest
+// state on zmk_esb_tx_space_available; the refused one was never sent, so
+// duplicate suppression does not know it either.
+static void esb_hid_backpressure(const struct device *dev, uint8_t type) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    atomic_inc(&data->stats.refused);
+    atomic_or(&data->hid.blocked, BIT(type));
+
+    k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+    // A slot freed before blocked was set raised nothing
+    bool space = data->hid.count < config->frame_queue_depth;
+    k_spin_unlock(&data->hid.lock, key);
+
+    if (space) {
+        k_work_submit(&data->hid.space_work);
+    }
+}
+
+#if IS_ENABLED(CONFIG_ZMK_HID_INDICATORS)
+// Indicator listeners expect thread context, not the UART ISR
+static void esb_hid_output_work(struct k_work *work) {
+    struct esb_transport_data *data =
+        CONTAINER_OF(work, struct esb_transport_data, hid.output_work);
+    struct zmk_hid_led_report_body report = {
+        .leds = (uint8_t)atomic_get(&data->hid.leds),
+    };
+
+    zmk_hid_indicators_process_report(
+        &report, (struct zmk_endpoint_instance){.transport = ZMK_TRANSPORT_ESB});
+}
+#endif
+
+// Host LED state forwarded by BLESB from an ESB ACK payload
+void esb_hid_handle_output(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    const struct esb_evt_hid_output *output = (const void *)payload;
+
+    if (len < sizeof(*output)) {
+        return;
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_HID_INDICATORS)
+    struct esb_transport_data *data = dev->data;
+
+    atomic_set(&data->hid.leds, output->leds);
+    k_work_submit(&data->hid.output_work);
+#else
+    LOG_DBG("Host LED state 0x%02x ignored without CONFIG_ZMK_HID_INDICATORS", output->leds);
+#endif
+}
+
+void esb_hid_queue_init(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    k_sem_init(&data->hid.space, 0, config->frame_queue_depth);
+    k_work_init(&data->hid.flush_work, esb_hid_flush_work);
+    k_work_init(&data->hid.space_work, esb_hid_space_work);
+    atomic_set(&data->hid.blocked, 0);
+#if IS_ENABLED(CONFIG_ZMK_HID_INDICATORS)
+    k_work_init(&data->hid.output_work, esb_hid_output_work);
+#endif
+    data->hid.count = 0;
+    data->hid.frag_index = 0;
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+    data->hid.live = 0;
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+    memset(data->hid.last_len, 0, sizeof(data->hid.last_len));
+    atomic_set(&data->hid.suppressed, 0);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    data->hid.bulk_passed = 0;
+#endif
+
+    for (uint8_t lane = 0; lane < ESB_LANE_COUNT; lane++) {
+        data->hid.lanes[lane].head = ESB_FRAME_NONE;
+        data->hid.lanes[lane].passed = 0;
+    }
+
+    // Chain every slot into the free list
+    for (uint8_t slot = 0; slot < config->frame_queue_depth; slot++) {
+        config->frames[slot].next = slot + 1 < config->frame_queue_depth ? slot + 1 : ESB_FRAME_NONE;
+    }
+    data->hid.free = 0;
+}
+
+// Called with the HID queue locked
+static void esb_hid_frame_fill(struct esb_frame *frame, uint8_t type, const uint8_t *report,
+                               size_t len, uint32_t stamp) {
+    struct hid_packet_header *header = (struct hid_packet_header *)frame->data;
+
+    header->type = type;
+    header->length = (uint8_t)len;
+    memcpy(&frame->data[sizeof(struct hid_packet_header)], report, len);
+    frame->len = sizeof(struct hid_packet_header) + len;
+    frame->stamp = stamp;
+}
+
+// Queue one HID report, header included, as a single frame
+int esb_hid_enqueue(const struct device *dev, uint8_t type, const uint8_t *report, size_t len,
+                    uint32_t stamp, k_timeout_t timeout) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    size_t total_len = sizeof(struct hid_packet_header) + len;
+
+    // Wait for a free slot, like the UART would block a direct write
+    while (true) {
+        k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+
+        if (data->hid.count < config->frame_queue_depth) {
+            struct esb_frame *frame = esb_hid_frame_push(dev, esb_hid_lane(type));
+
+            esb_hid_frame_fill(frame, type, report, len, stamp);
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+            // Only a report actually queued supersedes a snapshot; one that
+            // times out waiting leaves both the snapshot and its check alone
+            data->hid.live++;
+            esb_hid_drop_resync(dev, type == ESB_FRAME_SEQUENCED ? HID_PACKET_TYPE_KEYBOARD : type);
+#endif
+            k_spin_unlock(&data->hid.lock, key);
+            break;
+        }
+
+        k_spin_unlock(&data->hid.lock, key);
+        if (k_sem_take(&data->hid.space, timeout) != 0) {
+            return -EAGAIN;
+        }
+    }
+
+    LOG_DBG("Queued ESB HID packet: type=%d, len=%zu, total=%zu", type, len, total_len);
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+// Count of live reports queued so far, taken before reading a resync snapshot
+uint32_t esb_hid_live(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+    uint32_t live = data->hid.live;
+    k_spin_unlock(&data->hid.lock, key);
+
+    return live;
+}
+
+// Queue a state snapshot in the lowest lane. Returns -EALREADY when a live
+// report was queued since esb_hid_live() returned live, as the snapshot may
+// then be older than it; never waits for queue space.
+int esb_hid_enqueue_resync(const struct device *dev, uint8_t type, const uint8_t *report,
+                           size_t len, uint32_t stamp, uint32_t live) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    int err = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&data->hid.lock);
+
+    if (data->hid.live != live) {
+        err = -EALREADY;
+    } else if (data->hid.count >= config->frame_queue_depth) {
+        err = -EAGAIN;
+    } else {
+        esb_hid_frame_fill(esb_hid_frame_push(dev, ESB_LANE_RESYNC), type, report, len, stamp);
+    }
+
+    k_spin_unlock(&data->hid.lock, key);
+    return err;
+}
+#endif
+
+// Queue HID report with header as a SINGLE frame - much simpler for BLESB.
+// Never waits for queue space: returns -EAGAIN and raises
+// zmk_esb_tx_space_available once there is room.
+static int esb_hid_send(const struct device *dev, uint8_t type, const uint8_t *report,
+                        size_t len, uint32_t stamp) {
+    struct esb_transport_data *data = dev->data;
+
+    if (!device_is_ready(dev)) {
         return -ENODEV;
     }
-    
-    // Create complete packet: header + data in single buffer
-    uint8_t packet[64];  // Max ESB payload is 32, so 64 is plenty
-    struct hid_packet_header *header = (struct hid_packet_header *)packet;
-    
-    // Validate packet size
+
+    if (!esb_transport_is_connected(dev)) {
+        return -ENOTCONN;
+    }
+
+    // Frames beyond the negotiated payload are fragmented if BLESB supports it
     size_t total_len = sizeof(struct hid_packet_header) + len;
-    if (total_len > sizeof(packet)) {
+    if (total_len > sizeof(((struct esb_frame *)0)->data) ||
+        (total_len > data->max_payload && !(data->caps & ESB_CAPS_FRAGMENT))) {
         LOG_ERR("HID packet too large: %zu bytes", total_len);
         return -EINVAL;
     }
-    
-    // Build complete packet
-    header->type = type;
-    header->length = (uint8_t)len;
-    memcpy(&packet[sizeof(struct hid_packet_header)], report, len);
-    
-    // Send complete packet in ONE UART operation
-    LOG_DBG("Sending ESB HID packet: type=%d, len=%d, total=%zu", type, len, total_len);
-    
-    for (size_t i = 0; i < total_len; i++) {
-        uart_poll_out(esb_uart_dev, packet[i]);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_REPLAY)
+    // Refused like a full queue until the replay has sent the current state
+    if (type != HID_PACKET_TYPE_MOUSE && esb_replay_hold(dev)) {
+        atomic_inc(&data->stats.refused);
+        atomic_or(&data->hid.blocked, BIT(type));
+        return -EAGAIN;
     }
-    
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+    if (esb_hid_duplicate(dev, type, report, len)) {
+        return 0;
+    }
+#endif
+
+    esb_power_activity(dev, true);
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+    esb_resync_note_report();
+#endif
+#if CONFIG_ZMK_ESB_LINK_TIMEOUT_MS > 0
+    if (type != HID_PACKET_TYPE_MOUSE) {
+        esb_release_note_report();
+    }
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    if (type == HID_PACKET_TYPE_CONSUMER && esb_limit_defer_consumer(dev, report, len, stamp)) {
+        return 0;
+    }
+#endif
+
+    int err = 0;
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    // Motion inside the report interval waits in the merge window
+    if (type == HID_PACKET_TYPE_MOUSE) {
+        err = esb_rate_mouse_defer(dev, (const struct zmk_hid_mouse_report *)report, stamp);
+        if (err > 0) {
+            return 0;
+        }
+    }
+#endif
+
+    if (err == 0) {
+#if IS_ENABLED(CONFIG_ZMK_ESB_REDUNDANT_KEYS)
+        err = type == HID_PACKET_TYPE_KEYBOARD
+                  ? esb_redundant_send(dev, report, len, stamp)
+                  : esb_hid_enqueue(dev, type, report, len, stamp, K_NO_WAIT);
+#else
+        err = esb_hid_enqueue(dev, type, report, len, stamp, K_NO_WAIT);
+#endif
+    }
+
+    if (err == -EAGAIN) {
+        esb_hid_backpressure(dev, type);
+        // Send what is queued so the space frees up
+        esb_hid_flush(dev);
+    }
+    if (err) {
+        return err;
+    }
+
+    esb_hid_flush(dev);
     return 0;
 }
 
+static int zmk_esb_hid_send_report(const struct device *dev, uint8_t type,
+                                   const uint8_t *report, size_t len, uint32_t stamp) {
+    int ret = esb_hid_send(dev, type, report, len, stamp);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+    esb_hist_record(dev, type, ZMK_ESB_HIST_SEND, k_cycle_get_32() - stamp);
+#endif
+    return ret;
+}
+
 // Public HID transmission functions
 int zmk_esb_hid_send_keyboard_report(void) {
+    uint32_t stamp = k_cycle_get_32();
     struct zmk_hid_keyboard_report *report = zmk_hid_get_keyboard_report();
-    return zmk_esb_hid_send_report(HID_PACKET_TYPE_KEYBOARD, 
+    return zmk_esb_hid_send_report(esb_transport_default(), HID_PACKET_TYPE_KEYBOARD,
                                    (uint8_t *)&report->body, 
-                                   sizeof(report->body));
+                                   sizeof(report->body), stamp);
 }
 
 int zmk_esb_hid_send_consumer_report(void) {
+    uint32_t stamp = k_cycle_get_32();
     struct zmk_hid_consumer_report *report = zmk_hid_get_consumer_report();
-    return zmk_esb_hid_send_report(HID_PACKET_TYPE_CONSUMER,
+    return zmk_esb_hid_send_report(esb_transport_default(), HID_PACKET_TYPE_CONSUMER,
                                    (uint8_t *)report,
-                                   sizeof(*report));
+                                   sizeof(*report), stamp);
 }
 
 #if IS_ENABLED(CONFIG_ZMK_POINTING)
 int zmk_esb_hid_send_mouse_report(void) {
+    // Taken first: the deadline of a mouse frame counts from here
+    uint32_t stamp = k_cycle_get_32();
     struct zmk_hid_mouse_report *report = zmk_hid_get_mouse_report();
-    return zmk_esb_hid_send_report(HID_PACKET_TYPE_MOUSE,
+    return zmk_esb_hid_send_report(esb_transport_pointing(), HID_PACKET_TYPE_MOUSE,
                                    (uint8_t *)report,
-                                   sizeof(*report));
+                                   sizeof(*report), stamp);
 }
 #endif
 
+int zmk_esb_hid_get_stats(struct zmk_esb_hid_stats *stats) {
+    const struct device *dev;
+
+    if (stats == NULL) {
+        return -EINVAL;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+        stats->suppressed += atomic_get(&data->hid.suppressed);
+#else
+        ARG_UNUSED(data);
+#endif
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    esb_limit_get_stats(stats);
+#endif
+
+    return 0;
+}
+
 // Check if ESB HID is ready for transmission
 bool zmk_esb_hid_is_ready(void) {
     return zmk_esb_active_profile_is_connected();
@@ -90,10 +903,8 @@ bool zmk_esb_hid_is_ready(void) {
 
 // Initialize ESB HID transport
 static int esb_hid_init(void) {
-    esb_uart_dev = DEVICE_DT_GET(DT_CHOSEN(zmk_esb_uart));
-    
-    if (!device_is_ready(esb_uart_dev)) {
-        LOG_ERR("ESB UART device not ready for HID transmission");
+    if (!device_is_ready(esb_transport_default()) || !device_is_ready(esb_transport_pointing())) {
+        LOG_ERR("ESB transport device not ready for HID transmission");
         return -ENODEV;
     }
     
@@ -101,4 +912,4 @@ static int esb_hid_init(void) {
     return 0;
 }
 
-SYS_INIT(esb_hid_init, POST_KERNEL, CONFIG_ZMK_ESB_HID_INIT_PRIORITY);
\ No newline at end of file
+SYS_INIT(esb_hid_init, APPLICATION, CONFIG_ZMK_ESB_HID_INIT_PRIORITY);
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Bucket 0 holds 0 us, bucket n > 0 holds [2^(n-1), 2^n) us and the last one
+// everything above
+static int esb_hist_bucket(uint32_t us) {
+    return us == 0 ? 0 : MIN(LOG2(us) + 1, ESB_HIST_BUCKETS - 1);
+}
+
+// Report type of a frame or payload, looking inside the wrappers that carry a
+// single report or lead a batch. 0 for anything else.
+uint8_t esb_hist_frame_type(const uint8_t *buf) {
+    const uint8_t *payload = &buf[sizeof(struct hid_packet_header)];
+
+    switch (buf[0]) {
+    case HID_PACKET_TYPE_KEYBOARD:
+    case HID_PACKET_TYPE_CONSUMER:
+    case HID_PACKET_TYPE_MOUSE:
+        return buf[0];
+    case ESB_FRAME_BATCH:
+        return esb_hist_frame_type(payload);
+    case ESB_FRAME_SEQUENCED:
+        return ((const struct esb_seq_header *)payload)->type;
+    case ESB_FRAME_TIMED:
+        return ((const struct esb_timed_header *)payload)->type;
+    default:
+        return 0;
+    }
+}
+
+// Lock-free, safe from the UART ISR
+void esb_hist_record(const struct device *dev, uint8_t type, enum zmk_esb_hist hist,
+                     uint32_t cycles) {
+    struct esb_transport_data *data = dev->data;
+    uint32_t us = k_cyc_to_us_near32(cycles);
+
+    if (type < HID_PACKET_TYPE_KEYBOARD || type > HID_PACKET_TYPE_MOUSE) {
+        return;
+    }
+
+    atomic_inc(&data->hist.buckets[type - 1][hist][esb_hist_bucket(us)]);
+
+    atomic_t *max = &data->hist.max[type - 1][hist];
+    atomic_val_t old;
+    do {
+        old = atomic_get(max);
+    } while ((uint32_t)old < us && !atomic_cas(max, old, us));
+}
+
+// Called as a HID payload enters the UART ring. One payload at a time is timed
+// until its last byte is handed to the UART; others sent meanwhile are not.
+void esb_hist_note_payload(const struct device *dev, const uint8_t *buf) {
+    struct esb_transport_data *data = dev->data;
+    uint8_t type = esb_hist_frame_type(buf);
+
+    if (type == 0 || atomic_get(&data->hist.wire_left) > 0) {
+        return;
+    }
+
+    data->hist.wire_stamp = k_cycle_get_32();
+    data->hist.wire_type = type;
+    atomic_set(&data->hist.wire_left, esb_transport_tx_pending(dev));
+}
+
+// Called from the UART ISR with the bytes just handed to the UART
+void esb_hist_note_wire(const struct device *dev, size_t sent) {
+    struct esb_transport_data *data = dev->data;
+
+    if (sent == 0 || atomic_get(&data->hist.wire_left) <= 0) {
+        return;
+    }
+
+    if (atomic_sub(&data->hist.wire_left, sent) <= (atomic_val_t)sent) {
+        esb_hist_record(dev, data->hist.wire_type, ZMK_ESB_HIST_WIRE,
+                        k_cycle_get_32() - data->hist.wire_stamp);
+        atomic_set(&data->hist.wire_left, 0);
+    }
+}
+
+void esb_hist_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    atomic_set(&data->hist.wire_left, 0);
+}
+
+int zmk_esb_get_hist(enum zmk_esb_report_type type, enum zmk_esb_hist hist,
+                     struct zmk_esb_hist_summary *summary) {
+    uint32_t counts[ESB_HIST_BUCKETS];
+    uint32_t total = 0;
+
+    if (summary == NULL || type < ZMK_ESB_REPORT_KEYBOARD || type > ZMK_ESB_REPORT_MOUSE ||
+        hist >= ZMK_ESB_HIST_COUNT) {
+        return -EINVAL;
+    }
+
+    struct esb_transport_data *data = esb_transport_for_report(type)->data;
+
+    // A snapshot of counters that may move meanwhile, close enough
+    for (int i = 0; i < ESB_HIST_BUCKETS; i++) {
+        counts[i] = atomic_get(&data->hist.buckets[type - 1][hist][i]);
+        total += counts[i];
+    }
+
+    summary->count = total;
+    summary->max_us = atomic_get(&data->hist.max[type - 1][hist]);
+    summary->p50_us = 0;
+    summary->p99_us = 0;
+
+    // Percentiles are the upper bound of the bucket they fall in
+    uint32_t p50 = DIV_ROUND_UP(total * 50ULL, 100);
+    uint32_t p99 = DIV_ROUND_UP(total * 99ULL, 100);
+    uint32_t seen = 0;
+
+    for (int i = 0; i < ESB_HIST_BUCKETS && seen < p99; i++) {
+        uint32_t bound = i == ESB_HIST_BUCKETS - 1 ? summary->max_us : BIT(i) - 1;
+
+        if (seen < p50 && seen + counts[i] >= p50) {
+            summary->p50_us = MIN(bound, summary->max_us);
+        }
+        seen += counts[i];
+        if (seen >= p99) {
+            summary->p99_us = MIN(bound, summary->max_us);
+        }
+    }
+
+    return 0;
+}
+
+void zmk_esb_reset_hist(void) {
+    const struct device *dev;
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+
+        for (int type = 0; type < ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+            for (int hist = 0; hist < ZMK_ESB_HIST_COUNT; hist++) {
+                for (int b = 0; b < ESB_HIST_BUCKETS; b++) {
+                    atomic_set(&data->hist.buckets[type][hist][b], 0);
+                }
+                atomic_set(&data->hist.max[type][hist], 0);
+            }
+        }
+    }
+}
@@ -0,0 +1,203 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/hid.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Buckets count milli-tokens, so a rate in reports per second refills that
+// many milli-tokens per millisecond
+#define ESB_LIMIT_TOKEN 1000
+
+struct esb_limit_bucket {
+    uint32_t refill;              // Milli-tokens per ms, 0 when not limited
+    uint32_t size;                // Milli-tokens
+};
+
+// Keyboard state changes always get through
+static const struct esb_limit_bucket esb_limit_buckets[ZMK_ESB_REPORT_TYPE_COUNT] = {
+    [ZMK_ESB_REPORT_CONSUMER - 1] =
+        {
+            .refill = CONFIG_ZMK_ESB_CONSUMER_RATE,
+            .size = CONFIG_ZMK_ESB_CONSUMER_BURST * ESB_LIMIT_TOKEN,
+        },
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    [ZMK_ESB_REPORT_MOUSE - 1] =
+        {
+            .refill = CONFIG_ZMK_ESB_MOUSE_RATE,
+            .size = CONFIG_ZMK_ESB_MOUSE_BURST * ESB_LIMIT_TOKEN,
+        },
+#endif
+};
+
+// Called with the limit lock held. Buckets are refilled for the time since the
+// last refill whenever they are looked at, so nothing runs while reports don't.
+static void esb_limit_refill_locked(struct esb_transport_data *data) {
+    uint32_t now = k_uptime_get_32();
+    uint32_t elapsed = now - data->limit.last_refill;
+
+    if (elapsed == 0) {
+        return;
+    }
+
+    data->limit.last_refill = now;
+    for (int type = 0; type < ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+        uint64_t tokens =
+            data->limit.tokens[type] + (uint64_t)elapsed * esb_limit_buckets[type].refill;
+
+        data->limit.tokens[type] = MIN(tokens, esb_limit_buckets[type].size);
+    }
+}
+
+// Called with the limit lock held. A refused report is picked up again by
+// limit.work once the bucket holds the next token.
+static bool esb_limit_take_locked(struct esb_transport_data *data, uint8_t type) {
+    const struct esb_limit_bucket *bucket = &esb_limit_buckets[type - 1];
+
+    if (bucket->refill == 0) {
+        return true;
+    }
+
+    esb_limit_refill_locked(data);
+
+    if (data->limit.tokens[type - 1] < ESB_LIMIT_TOKEN) {
+        uint32_t wait = DIV_ROUND_UP(ESB_LIMIT_TOKEN - data->limit.tokens[type - 1], bucket->refill);
+
+        k_work_schedule(&data->limit.work, K_MSEC(wait));
+        return false;
+    }
+
+    data->limit.tokens[type - 1] -= ESB_LIMIT_TOKEN;
+    return true;
+}
+
+// Callers count the reports they hold back in limit.limited
+bool esb_limit_take(const struct device *dev, uint8_t type) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->limit.lock);
+    bool ok = esb_limit_take_locked(data, type);
+    k_spin_unlock(&data->limit.lock, key);
+
+    return ok;
+}
+
+// Send the consumer state held back for a token, and let merged motion go
+static void esb_limit_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data = CONTAINER_OF(dwork, struct esb_transport_data, limit.work);
+    const struct device *dev = data->dev;
+    struct zmk_hid_consumer_report report;
+    uint32_t stamp;
+
+    k_spinlock_key_t key = k_spin_lock(&data->limit.lock);
+    bool send = data->limit.consumer_pending &&
+                esb_limit_take_locked(data, HID_PACKET_TYPE_CONSUMER);
+    if (send) {
+        report = data->limit.consumer;
+        stamp = data->limit.consumer_stamp;
+        data->limit.consumer_pending = false;
+    }
+    k_spin_unlock(&data->limit.lock, key);
+
+    if (send && esb_transport_is_connected(dev)) {
+        esb_power_activity(dev, true);
+        if (esb_hid_enqueue(dev, HID_PACKET_TYPE_CONSUMER, (const uint8_t *)&report,
+                            sizeof(report), stamp, K_NO_WAIT) != 0) {
+            // Queue full: hand the token back and retry, unless a newer state
+            // is waiting meanwhile
+            key = k_spin_lock(&data->limit.lock);
+            data->limit.tokens[HID_PACKET_TYPE_CONSUMER - 1] =
+                MIN(data->limit.tokens[HID_PACKET_TYPE_CONSUMER - 1] + ESB_LIMIT_TOKEN,
+                    esb_limit_buckets[HID_PACKET_TYPE_CONSUMER - 1].size);
+            if (!data->limit.consumer_pending) {
+                data->limit.consumer = report;
+                data->limit.consumer_stamp = stamp;
+                data->limit.consumer_pending = true;
+            }
+            k_spin_unlock(&data->limit.lock, key);
+            k_work_schedule(&data->limit.work, K_MSEC(1));
+        }
+        esb_hid_flush(dev);
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    // Leaves a report interval still running alone
+    if (data->rate.mouse_pending) {
+        k_work_schedule(&data->rate.mouse_work, K_NO_WAIT);
+    }
+#endif
+}
+
+void esb_limit_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    for (int type = 0; type < ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+        data->limit.tokens[type] = esb_limit_buckets[type].size;
+        atomic_set(&data->limit.limited[type], 0);
+    }
+    data->limit.last_refill = k_uptime_get_32();
+    data->limit.consumer_pending = false;
+    k_work_init_delayable(&data->limit.work, esb_limit_work);
+}
+
+// Consumer reports over budget are coalesced: the latest state waits for the
+// next token, replacing any state already waiting
+bool esb_limit_defer_consumer(const struct device *dev, const uint8_t *report, size_t len,
+                              uint32_t stamp) {
+    struct esb_transport_data *data = dev->data;
+    bool deferred = true;
+
+    if (len != sizeof(data->limit.consumer)) {
+        return false;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->limit.lock);
+
+    if (!data->limit.consumer_pending && esb_limit_take_locked(data, HID_PACKET_TYPE_CONSUMER)) {
+        deferred = false;
+    } else {
+        if (!data->limit.consumer_pending) {
+            data->limit.consumer_stamp = stamp;
+        }
+        memcpy(&data->limit.consumer, report, len);
+        data->limit.consumer_pending = true;
+    }
+
+    k_spin_unlock(&data->limit.lock, key);
+
+    if (deferred) {
+        atomic_inc(&data->limit.limited[HID_PACKET_TYPE_CONSUMER - 1]);
+    }
+    return deferred;
+}
+
+// Drop consumer state waiting for a token
+void esb_limit_reset(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->limit.lock);
+    data->limit.consumer_pending = false;
+    k_spin_unlock(&data->limit.lock, key);
+
+    k_work_cancel_delayable(&data->limit.work);
+}
+
+// Bucket state of each type on the instance that carries it
+void esb_limit_get_stats(struct zmk_esb_hid_stats *stats) {
+    for (int type = 0; type < ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+        struct esb_transport_data *data = esb_transport_for_report(type + 1)->data;
+
+        k_spinlock_key_t key = k_spin_lock(&data->limit.lock);
+        esb_limit_refill_locked(data);
+        stats->buckets[type].tokens = data->limit.tokens[type] / ESB_LIMIT_TOKEN;
+        k_spin_unlock(&data->limit.lock, key);
+
+        stats->buckets[type].burst = esb_limit_buckets[type].size / ESB_LIMIT_TOKEN;
+        stats->buckets[type].limited = atomic_get(&data->limit.limited[type]);
+    }
+}
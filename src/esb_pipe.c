@@ -0,0 +1,105 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define ESB_PIPE_MAX 7
+
+static const struct zmk_esb_pipe_config esb_pipe_defaults[ZMK_ESB_REPORT_TYPE_COUNT] = {
+    [ZMK_ESB_REPORT_KEYBOARD - 1] = {
+        .pipe = CONFIG_ZMK_ESB_KEYBOARD_PIPE,
+        .retransmit_count = CONFIG_ZMK_ESB_KEYBOARD_RETRANSMIT_COUNT,
+        .retransmit_delay_us = CONFIG_ZMK_ESB_KEYBOARD_RETRANSMIT_DELAY_US,
+    },
+    [ZMK_ESB_REPORT_CONSUMER - 1] = {
+        .pipe = CONFIG_ZMK_ESB_CONSUMER_PIPE,
+        .retransmit_count = CONFIG_ZMK_ESB_CONSUMER_RETRANSMIT_COUNT,
+        .retransmit_delay_us = CONFIG_ZMK_ESB_CONSUMER_RETRANSMIT_DELAY_US,
+    },
+    [ZMK_ESB_REPORT_MOUSE - 1] = {
+        .pipe = CONFIG_ZMK_ESB_MOUSE_PIPE,
+        .retransmit_count = CONFIG_ZMK_ESB_MOUSE_RETRANSMIT_COUNT,
+        .retransmit_delay_us = CONFIG_ZMK_ESB_MOUSE_RETRANSMIT_DELAY_US,
+    },
+};
+
+static bool esb_pipe_type_valid(enum zmk_esb_report_type type) {
+    return type >= ZMK_ESB_REPORT_KEYBOARD && type <= ZMK_ESB_REPORT_TYPE_COUNT;
+}
+
+static int esb_pipe_send(const struct device *dev, enum zmk_esb_report_type type,
+                         k_timeout_t timeout) {
+    const struct esb_transport_data *data = dev->data;
+    const struct zmk_esb_pipe_config *pipe = &data->pipes[type - 1];
+
+    struct esb_ctrl_pipe_config msg = {
+        .report_type = type,
+        .pipe = pipe->pipe,
+        .retransmit_count = pipe->retransmit_count,
+        .retransmit_delay_us = sys_cpu_to_le16(pipe->retransmit_delay_us),
+    };
+
+    return esb_transport_send_ctrl(dev, ESB_CTRL_PIPE_CONFIG, &msg, sizeof(msg), timeout);
+}
+
+void esb_pipe_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    memcpy(data->pipes, esb_pipe_defaults, sizeof(data->pipes));
+}
+
+// Push the routing of every report type this instance carries
+int esb_pipe_sync(const struct device *dev) {
+    for (int type = ZMK_ESB_REPORT_KEYBOARD; type <= ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+        if (esb_transport_for_report(type) != dev) {
+            continue;
+        }
+
+        int err = esb_pipe_send(dev, type, K_NO_WAIT);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+int zmk_esb_set_report_pipe(enum zmk_esb_report_type type,
+                            const struct zmk_esb_pipe_config *config) {
+    if (!esb_pipe_type_valid(type) || config == NULL || config->pipe > ESB_PIPE_MAX) {
+        return -EINVAL;
+    }
+
+    const struct device *dev = esb_transport_for_report(type);
+    struct esb_transport_data *data = dev->data;
+
+    data->pipes[type - 1] = *config;
+
+    LOG_DBG("ESB report type %d -> pipe %d, %d retransmits every %dus", type, config->pipe,
+            config->retransmit_count, config->retransmit_delay_us);
+
+    // Pushed on connect otherwise
+    if (!esb_transport_is_connected(dev)) {
+        return 0;
+    }
+
+    return esb_pipe_send(dev, type, K_FOREVER);
+}
+
+int zmk_esb_get_report_pipe(enum zmk_esb_report_type type, struct zmk_esb_pipe_config *config) {
+    if (!esb_pipe_type_valid(type) || config == NULL) {
+        return -EINVAL;
+    }
+
+    const struct esb_transport_data *data = esb_transport_for_report(type)->data;
+
+    *config = data->pipes[type - 1];
+    return 0;
+}
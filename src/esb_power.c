@@ -0,0 +1,602 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/event_manager.h>
+#include <zmk/events/position_state_changed.h>
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_LATENCY_MODE_DEFAULT_EFFICIENCY)
+#define ESB_POWER_MODE_DEFAULT ZMK_ESB_LATENCY_EFFICIENCY
+#else
+#define ESB_POWER_MODE_DEFAULT ZMK_ESB_LATENCY_PERFORMANCE
+#endif
+
+// Width of the pulse on wake-gpios
+#define ESB_POWER_STROBE_US 10
+// How often to check whether the sleep command has left the UART
+#define ESB_POWER_DRAIN_POLL K_MSEC(1)
+
+enum esb_power_state {
+    ESB_POWER_ACTIVE,
+    ESB_POWER_SLEEPING,           // Sleep command queued, UART still held
+    ESB_POWER_ASLEEP,             // UART released to runtime PM
+};
+
+static enum zmk_esb_latency_mode esb_latency_mode = ESB_POWER_MODE_DEFAULT;
+
+// The link reference keeps the UART receiving whenever BLESB may talk without
+// asserting host-wake first: always in performance mode, and while awake in
+// efficiency mode unless host-wake-gpios is wired.
+static void esb_power_update_link(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    if (!data->power.enabled) {
+        return;
+    }
+
+    k_mutex_lock(&data->power.pm_lock, K_FOREVER);
+
+    bool want = esb_latency_mode == ZMK_ESB_LATENCY_PERFORMANCE ||
+                (data->power.state != ESB_POWER_ASLEEP && !config->has_host_wake);
+
+    if (want && !data->power.link_ref) {
+        pm_device_runtime_get(config->uart);
+        uart_irq_rx_enable(config->uart);
+    } else if (!want && data->power.link_ref) {
+        pm_device_runtime_put(config->uart);
+    }
+    data->power.link_ref = want;
+
+    k_mutex_unlock(&data->power.pm_lock);
+}
+
+// Hold the UART until everything queued from here on has left it. Called from
+// threads before queueing; the UART ISR drops the reference once drained.
+//
+// tx_ref and tx_used are guarded by tx_lock, like the TX queue the ISR checks
+// before dropping the reference. Getting it again clears tx_used, so bytes
+// drained before the caller queues its own cannot release it early.
+void esb_power_tx_get(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+    enum pm_device_state state;
+
+    k_mutex_lock(&data->power.pm_lock, K_FOREVER);
+
+    k_spinlock_key_t key = k_spin_lock(&data->tx_lock);
+    bool held = data->power.tx_ref;
+    data->power.tx_used = false;
+    k_spin_unlock(&data->tx_lock, key);
+
+    if (!held) {
+        bool resume = pm_device_state_get(config->uart, &state) == 0 &&
+                      state == PM_DEVICE_STATE_SUSPENDED;
+
+        data->power.resume_start = k_cycle_get_32();
+        pm_device_runtime_get(config->uart);
+        if (resume) {
+            uart_irq_rx_enable(config->uart);
+            data->power.resuming = true;
+        }
+
+        key = k_spin_lock(&data->tx_lock);
+        data->power.tx_ref = true;
+        data->power.tx_used = false;
+        k_spin_unlock(&data->tx_lock, key);
+    }
+
+    k_mutex_unlock(&data->power.pm_lock);
+}
+
+// Called from the UART ISR once the TX queue is empty
+void esb_power_tx_idle(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    // A UART too slow to resume within budget keeps its reference for good
+    if (data->power.pinned || esb_hid_pending(dev)) {
+        return;
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    // Kept until BLESB acknowledges everything: this ISR cannot take the
+    // reference back for the segments an ACK lets out
+    if (esb_bulk_busy(dev)) {
+        return;
+    }
+#endif
+
+    k_spinlock_key_t key = k_spin_lock(&data->tx_lock);
+    bool release = data->power.tx_ref && data->power.tx_used &&
+                   ring_buf_is_empty(&data->tx_ring);
+    if (release) {
+        data->power.tx_ref = false;
+        data->power.tx_used = false;
+    }
+    k_spin_unlock(&data->tx_lock, key);
+
+    if (release) {
+        pm_device_runtime_put_async(config->uart, K_MSEC(CONFIG_ZMK_ESB_UART_SUSPEND_DELAY_MS));
+    }
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+// A firmware update writes straight to the UART and waits for BLESB with the TX
+// queue empty, so it keeps the UART from start to finish
+void esb_power_dfu_hold(const struct device *dev, bool hold) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    k_mutex_lock(&data->power.pm_lock, K_FOREVER);
+
+    if (hold && !data->power.dfu_ref) {
+        pm_device_runtime_get(config->uart);
+        uart_irq_rx_enable(config->uart);
+    } else if (!hold && data->power.dfu_ref) {
+        pm_device_runtime_put(config->uart);
+    }
+    data->power.dfu_ref = hold;
+
+    k_mutex_unlock(&data->power.pm_lock);
+}
+#endif
+
+// Called from the UART ISR as the first byte after a resume enters the FIFO
+void esb_power_note_resume_tx(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    if (!data->power.resuming) {
+        return;
+    }
+
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - data->power.resume_start);
+
+    data->power.resuming = false;
+    data->power.resume.count++;
+    data->power.resume.last_us = us;
+    data->power.resume.max_us = MAX(data->power.resume.max_us, us);
+
+    if (us > CONFIG_ZMK_ESB_UART_RESUME_BUDGET_US && !data->power.pinned) {
+        data->power.pinned = true;
+        LOG_WRN("ESB UART resume took %u us, keeping it powered", us);
+    }
+}
+
+// BLESB asserts host-wake before sending and releases it once done
+static void esb_power_host_wake_work(struct k_work *work) {
+    struct esb_transport_data *data =
+        CONTAINER_OF(work, struct esb_transport_data, power.host_wake_work);
+    const struct esb_transport_config *config = data->dev->config;
+    bool asserted = gpio_pin_get_dt(&config->host_wake_gpio) > 0;
+
+    k_mutex_lock(&data->power.pm_lock, K_FOREVER);
+
+    if (asserted && !data->power.rx_ref) {
+        pm_device_runtime_get(config->uart);
+        uart_irq_rx_enable(config->uart);
+    } else if (!asserted && data->power.rx_ref) {
+        pm_device_runtime_put_async(config->uart, K_MSEC(CONFIG_ZMK_ESB_UART_SUSPEND_DELAY_MS));
+    }
+    data->power.rx_ref = asserted;
+
+    k_mutex_unlock(&data->power.pm_lock);
+}
+
+static void esb_power_host_wake_isr(const struct device *port, struct gpio_callback *cb,
+                                    uint32_t pins) {
+    struct esb_transport_data *data =
+        CONTAINER_OF(cb, struct esb_transport_data, power.host_wake_cb);
+
+    k_work_submit(&data->power.host_wake_work);
+}
+
+// Sent straight to the UART queue so it does not count as link activity
+static int esb_power_send(const struct device *dev, uint8_t mode, k_timeout_t timeout) {
+    uint8_t frame[sizeof(struct hid_packet_header) + sizeof(struct esb_ctrl_power)];
+    struct hid_packet_header *header = (struct hid_packet_header *)frame;
+    struct esb_ctrl_power *msg = (struct esb_ctrl_power *)&frame[sizeof(*header)];
+
+    header->type = ESB_CTRL_POWER;
+    header->length = sizeof(*msg);
+    msg->mode = mode;
+
+    return esb_transport_tx(dev, frame, sizeof(frame), timeout);
+}
+
+static uint8_t esb_power_mode_msg(void) {
+    return esb_latency_mode == ZMK_ESB_LATENCY_EFFICIENCY ? ESB_POWER_EFFICIENCY
+                                                          : ESB_POWER_PERFORMANCE;
+}
+
+int esb_power_sync(const struct device *dev) {
+    return esb_power_send(dev, esb_power_mode_msg(), K_NO_WAIT);
+}
+
+static void esb_power_strobe(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+
+    if (config->has_wake) {
+        gpio_pin_set_dt(&config->wake_gpio, 1);
+        k_busy_wait(ESB_POWER_STROBE_US);
+        gpio_pin_set_dt(&config->wake_gpio, 0);
+    } else {
+        // An empty line is ignored by BLESB but its start bit wakes the UART
+        esb_transport_tx(dev, (const uint8_t *)"\n", 1, K_NO_WAIT);
+    }
+}
+
+// Bring the UART back and wake BLESB. Frames are held until BLESB can receive.
+static void esb_power_wake(const struct device *dev, bool report) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->power.lock);
+    enum esb_power_state state = data->power.state;
+    data->power.state = ESB_POWER_ACTIVE;
+    k_spin_unlock(&data->power.lock, key);
+
+    if (state == ESB_POWER_ACTIVE) {
+        return;
+    }
+
+    k_work_cancel_delayable(&data->power.idle_work);
+    if (state == ESB_POWER_ASLEEP) {
+        esb_power_update_link(dev);
+    }
+
+    uint32_t now = k_cycle_get_32();
+
+    data->power.wake_start = now;
+    data->power.wake_ready = now + k_us_to_cyc_ceil32(CONFIG_ZMK_ESB_WAKE_TIME_US);
+    data->power.waking = true;
+    data->power.measuring = report;
+    esb_power_strobe(dev);
+}
+
+// Anything about to be sent keeps the link awake; report is set when a HID
+// report follows, which is what the wake latency is measured against
+void esb_power_activity(const struct device *dev, bool report) {
+    struct esb_transport_data *data = dev->data;
+
+    esb_power_tx_get(dev);
+    esb_power_wake(dev, report);
+
+    if (esb_latency_mode == ZMK_ESB_LATENCY_EFFICIENCY) {
+        k_work_reschedule(&data->power.idle_work, K_MSEC(CONFIG_ZMK_ESB_IDLE_TIMEOUT_MS));
+    }
+}
+
+// Awake and past the wake time, so frames go out without waking anything
+bool esb_power_is_awake(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+    return data->power.state == ESB_POWER_ACTIVE && !data->power.waking;
+}
+
+// Called with the HID queue locked while BLESB is still waking up
+bool esb_power_hold(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    if (!data->power.waking) {
+        return false;
+    }
+
+    int32_t wait = (int32_t)(data->power.wake_ready - k_cycle_get_32());
+    if (wait <= 0) {
+        data->power.waking = false;
+        return false;
+    }
+
+    if (!k_work_delayable_is_pending(&data->power.wake_work)) {
+        k_work_schedule(&data->power.wake_work, K_TICKS(k_cyc_to_ticks_ceil32(wait)));
+    }
+
+    return true;
+}
+
+// First HID payload after a wake is on its way: record wake-to-report latency
+void esb_power_note_tx(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    if (!data->power.measuring) {
+        return;
+    }
+
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - data->power.wake_start);
+
+    data->power.measuring = false;
+    data->power.stats.wakes++;
+    data->power.stats.last_us = us;
+    data->power.stats.max_us = MAX(data->power.stats.max_us, us);
+}
+
+static void esb_power_wake_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, power.wake_work);
+
+    esb_hid_flush(data->dev);
+}
+
+static bool esb_power_busy(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+    bool busy = data->hid.count > 0 || esb_transport_tx_pending(dev) > 0;
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    busy = busy || data->bulk.tail != data->bulk.head;
+#endif
+    return busy;
+}
+
+// Idle timeout in efficiency mode: put BLESB to sleep, then release the UART
+// once the sleep command has left it
+static void esb_power_idle_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, power.idle_work);
+    const struct device *dev = data->dev;
+    const struct esb_transport_config *config = dev->config;
+
+    if (esb_latency_mode != ZMK_ESB_LATENCY_EFFICIENCY || !esb_transport_is_connected(dev)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->power.lock);
+    enum esb_power_state state = data->power.state;
+    k_spin_unlock(&data->power.lock, key);
+
+    if (state == ESB_POWER_ACTIVE) {
+        if (esb_power_busy(dev)) {
+            k_work_schedule(&data->power.idle_work, K_MSEC(CONFIG_ZMK_ESB_IDLE_TIMEOUT_MS));
+            return;
+        }
+
+        esb_power_tx_get(dev);
+        if (esb_power_send(dev, ESB_POWER_SLEEP, K_NO_WAIT) != 0) {
+            k_work_schedule(&data->power.idle_work, ESB_POWER_DRAIN_POLL);
+            return;
+        }
+
+        key = k_spin_lock(&data->power.lock);
+        if (data->power.state == ESB_POWER_ACTIVE) {
+            data->power.state = ESB_POWER_SLEEPING;
+        }
+        k_spin_unlock(&data->power.lock, key);
+
+        k_work_schedule(&data->power.idle_work, ESB_POWER_DRAIN_POLL);
+        return;
+    }
+
+    if (state != ESB_POWER_SLEEPING) {
+        return;
+    }
+
+    if (esb_transport_tx_pending(dev) > 0 || uart_irq_tx_complete(config->uart) == 0) {
+        k_work_schedule(&data->power.idle_work, ESB_POWER_DRAIN_POLL);
+        return;
+    }
+
+    key = k_spin_lock(&data->power.lock);
+    bool release = data->power.state == ESB_POWER_SLEEPING;
+    if (release) {
+        data->power.state = ESB_POWER_ASLEEP;
+    }
+    k_spin_unlock(&data->power.lock, key);
+
+    if (release) {
+        esb_power_update_link(dev);
+        LOG_DBG("ESB link asleep");
+    }
+}
+
+void esb_power_init(const struct device *dev) {
+    const struct esb_transport_config *config = dev->config;
+    struct esb_transport_data *data = dev->data;
+
+    data->power.state = ESB_POWER_ACTIVE;
+    data->power.waking = false;
+    data->power.measuring = false;
+    data->power.link_ref = false;
+    data->power.rx_ref = false;
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+    data->power.dfu_ref = false;
+#endif
+    data->power.pinned = false;
+    data->power.resuming = false;
+    data->power.tx_ref = false;
+    data->power.tx_used = false;
+    k_mutex_init(&data->power.pm_lock);
+    k_work_init_delayable(&data->power.idle_work, esb_power_idle_work);
+    k_work_init_delayable(&data->power.wake_work, esb_power_wake_work);
+    k_work_init(&data->power.host_wake_work, esb_power_host_wake_work);
+
+    if (config->has_wake) {
+        if (gpio_is_ready_dt(&config->wake_gpio)) {
+            gpio_pin_configure_dt(&config->wake_gpio, GPIO_OUTPUT_INACTIVE);
+        } else {
+            LOG_WRN("ESB wake GPIO not ready");
+        }
+    }
+
+    if (config->has_host_wake) {
+        if (gpio_is_ready_dt(&config->host_wake_gpio)) {
+            gpio_pin_configure_dt(&config->host_wake_gpio, GPIO_INPUT);
+            gpio_init_callback(&data->power.host_wake_cb, esb_power_host_wake_isr,
+                               BIT(config->host_wake_gpio.pin));
+            gpio_add_callback(config->host_wake_gpio.port, &data->power.host_wake_cb);
+            gpio_pin_interrupt_configure_dt(&config->host_wake_gpio, GPIO_INT_EDGE_BOTH);
+            // BLESB may be mid-message already
+            esb_power_host_wake_work(&data->power.host_wake_work);
+        } else {
+            LOG_WRN("ESB host-wake GPIO not ready");
+        }
+    }
+
+    data->power.enabled = true;
+    esb_power_update_link(dev);
+}
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+static void esb_power_save_work(struct k_work *work) {
+    uint8_t mode = esb_latency_mode;
+
+    int err = settings_save_one("esb/latency", &mode, sizeof(mode));
+    if (err) {
+        LOG_ERR("Failed to save ESB latency mode (%d)", err);
+    }
+}
+
+static K_WORK_DELAYABLE_DEFINE(esb_power_save, esb_power_save_work);
+
+int esb_power_settings_set(size_t len, settings_read_cb read_cb, void *cb_arg) {
+    uint8_t mode;
+
+    if (len != sizeof(mode) || read_cb(cb_arg, &mode, sizeof(mode)) < 0) {
+        return -EINVAL;
+    }
+
+    if (mode == ZMK_ESB_LATENCY_PERFORMANCE || mode == ZMK_ESB_LATENCY_EFFICIENCY) {
+        esb_latency_mode = mode;
+    }
+    return 0;
+}
+
+// The saved mode may load after BLESB already confirmed ESB mode
+void esb_power_settings_commit(void) {
+    const struct device *dev;
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+
+        if (!data->power.enabled) {
+            continue;
+        }
+
+        if (esb_latency_mode == ZMK_ESB_LATENCY_PERFORMANCE) {
+            k_work_cancel_delayable(&data->power.idle_work);
+        }
+
+        if (esb_transport_is_connected(dev)) {
+            esb_power_activity(dev, false);
+            esb_power_sync(dev);
+        }
+
+        esb_power_update_link(dev);
+    }
+}
+#endif
+
+int zmk_esb_set_latency_mode(enum zmk_esb_latency_mode mode) {
+    const struct device *dev;
+    int ret = 0;
+
+    if (mode != ZMK_ESB_LATENCY_PERFORMANCE && mode != ZMK_ESB_LATENCY_EFFICIENCY) {
+        return -EINVAL;
+    }
+
+    esb_latency_mode = mode;
+    LOG_INF("ESB latency mode: %s", mode == ZMK_ESB_LATENCY_EFFICIENCY ? "efficiency"
+                                                                        : "performance");
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+
+        // An instance left disabled at boot never takes the UART
+        if (!data->power.enabled) {
+            continue;
+        }
+
+        if (mode == ZMK_ESB_LATENCY_PERFORMANCE) {
+            k_work_cancel_delayable(&data->power.idle_work);
+        }
+
+        if (!esb_transport_is_connected(dev)) {
+            continue;
+        }
+
+        esb_power_activity(dev, false);
+
+        int err = esb_power_send(dev, esb_power_mode_msg(), K_FOREVER);
+        if (err) {
+            ret = err;
+        }
+    }
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        esb_power_update_link(dev);
+    }
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+    k_work_reschedule(&esb_power_save, K_MSEC(CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE));
+#endif
+
+    return ret;
+}
+
+enum zmk_esb_latency_mode zmk_esb_get_latency_mode(void) { return esb_latency_mode; }
+
+void zmk_esb_wake(void) {
+    const struct device *dev;
+
+    if (esb_latency_mode != ZMK_ESB_LATENCY_EFFICIENCY) {
+        return;
+    }
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        if (esb_transport_is_connected(dev)) {
+            esb_power_activity(dev, true);
+        }
+    }
+}
+
+int zmk_esb_get_wake_stats(struct zmk_esb_wake_stats *stats) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+
+    if (stats == NULL) {
+        return -EINVAL;
+    }
+
+    stats->wakes = data->power.stats.wakes;
+    stats->last_us = data->power.stats.last_us;
+    stats->max_us = data->power.stats.max_us;
+    return 0;
+}
+
+int zmk_esb_get_resume_stats(struct zmk_esb_resume_stats *stats) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+
+    if (stats == NULL) {
+        return -EINVAL;
+    }
+
+    stats->resumes = data->power.resume.count;
+    stats->last_us = data->power.resume.last_us;
+    stats->max_us = data->power.resume.max_us;
+    stats->pinned = data->power.pinned;
+    return 0;
+}
+
+// Pre-wake on the first key press, while the keymap is still resolving it
+static int esb_power_listener(const zmk_event_t *eh) {
+    const struct zmk_position_state_changed *ev = as_zmk_position_state_changed(eh);
+
+    if (ev != NULL && ev->state) {
+        zmk_esb_wake();
+    }
+
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(esb_power, esb_power_listener);
+ZMK_SUBSCRIPTION(esb_power, zmk_position_state_changed);
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+static struct esb_profile *esb_profile_active(struct esb_transport_data *data) {
+    return &data->profiles.list[data->profiles.active];
+}
+
+static bool esb_profile_is_open(const struct esb_profile *profile) {
+    static const struct zmk_esb_address empty;
+
+    return memcmp(&profile->address, &empty, sizeof(empty)) == 0;
+}
+
+// Restore the dongle address and last-known channel in one message
+static int esb_profile_send(const struct device *dev, k_timeout_t timeout) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_profile *profile = esb_profile_active(data);
+
+    struct esb_ctrl_profile msg = {
+        .channel = profile->channel,
+    };
+    memcpy(msg.base_addr_0, profile->address.base_addr_0, sizeof(msg.base_addr_0));
+    memcpy(msg.base_addr_1, profile->address.base_addr_1, sizeof(msg.base_addr_1));
+    memcpy(msg.prefixes, profile->address.prefixes, sizeof(msg.prefixes));
+
+    return esb_transport_send_ctrl(dev, ESB_CTRL_PROFILE, &msg, sizeof(msg), timeout);
+}
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+static void esb_profile_save_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, profiles.save_work);
+    const struct esb_transport_config *config = data->dev->config;
+    char name[32];
+
+    for (int i = 0; i < CONFIG_ZMK_ESB_PROFILE_COUNT; i++) {
+        snprintf(name, sizeof(name), "esb/%d/profiles/%d", config->index, i);
+        int err = settings_save_one(name, &data->profiles.list[i], sizeof(struct esb_profile));
+        if (err) {
+            LOG_ERR("Failed to save ESB profile %d (%d)", i, err);
+        }
+    }
+
+    snprintf(name, sizeof(name), "esb/%d/active", config->index);
+    int err = settings_save_one(name, &data->profiles.active, sizeof(data->profiles.active));
+    if (err) {
+        LOG_ERR("Failed to save active ESB profile (%d)", err);
+    }
+}
+#endif
+
+static void esb_profile_schedule_save(struct esb_transport_data *data) {
+#if IS_ENABLED(CONFIG_SETTINGS)
+    k_work_reschedule(&data->profiles.save_work, K_MSEC(CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE));
+#endif
+}
+
+void esb_profile_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    memset(data->profiles.list, 0, sizeof(data->profiles.list));
+    data->profiles.active = 0;
+#if IS_ENABLED(CONFIG_SETTINGS)
+    k_work_init_delayable(&data->profiles.save_work, esb_profile_save_work);
+#endif
+}
+
+int esb_profile_sync(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_profile *profile = esb_profile_active(data);
+
+    if (!esb_profile_is_open(profile)) {
+        esb_channel_set_active(dev, profile->channel);
+    }
+
+    return esb_profile_send(dev, K_NO_WAIT);
+}
+
+void esb_profile_note_channel(const struct device *dev, uint8_t channel) {
+    struct esb_transport_data *data = dev->data;
+    struct esb_profile *profile = esb_profile_active(data);
+
+    if (esb_profile_is_open(profile) || profile->channel == channel) {
+        return;
+    }
+
+    profile->channel = channel;
+    esb_profile_schedule_save(data);
+}
+
+void esb_profile_handle_paired(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    struct esb_profile *profile = esb_profile_active(data);
+    const struct esb_ctrl_profile *msg = (const void *)payload;
+
+    if (len < sizeof(*msg)) {
+        LOG_WRN("Short ESB pairing result: %d bytes", len);
+        return;
+    }
+
+    memcpy(profile->address.base_addr_0, msg->base_addr_0, sizeof(msg->base_addr_0));
+    memcpy(profile->address.base_addr_1, msg->base_addr_1, sizeof(msg->base_addr_1));
+    memcpy(profile->address.prefixes, msg->prefixes, sizeof(msg->prefixes));
+    profile->channel = msg->channel;
+    esb_profile_schedule_save(data);
+
+    esb_channel_set_active(dev, msg->channel);
+
+    LOG_INF("ESB profile %d paired on channel %d", data->profiles.active, msg->channel);
+}
+
+// Apply a profile change to BLESB, pushed on connect otherwise
+static int esb_profile_changed(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    esb_profile_schedule_save(data);
+
+    if (!esb_transport_is_connected(dev)) {
+        return 0;
+    }
+
+    return esb_profile_send(dev, K_FOREVER);
+}
+
+int zmk_esb_prof_select(uint8_t index) {
+    const struct device *dev = esb_transport_default();
+    struct esb_transport_data *data = dev->data;
+
+    if (index >= CONFIG_ZMK_ESB_PROFILE_COUNT) {
+        return -EINVAL;
+    }
+
+    if (data->profiles.active == index) {
+        return 0;
+    }
+
+    LOG_DBG("ESB profile %d selected", index);
+    data->profiles.active = index;
+
+    return esb_profile_changed(dev);
+}
+
+int zmk_esb_prof_next(void) {
+    return zmk_esb_prof_select((zmk_esb_active_profile_index() + 1) %
+                               CONFIG_ZMK_ESB_PROFILE_COUNT);
+}
+
+int zmk_esb_prof_prev(void) {
+    return zmk_esb_prof_select((zmk_esb_active_profile_index() + CONFIG_ZMK_ESB_PROFILE_COUNT -
+                                1) %
+                               CONFIG_ZMK_ESB_PROFILE_COUNT);
+}
+
+int zmk_esb_active_profile_index(void) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+
+    return data->profiles.active;
+}
+
+bool zmk_esb_active_profile_is_open(void) {
+    struct esb_transport_data *data = esb_transport_default()->data;
+
+    return esb_profile_is_open(esb_profile_active(data));
+}
+
+int zmk_esb_clear_prof(void) {
+    const struct device *dev = esb_transport_default();
+    struct esb_transport_data *data = dev->data;
+
+    LOG_DBG("ESB profile %d cleared", data->profiles.active);
+    memset(esb_profile_active(data), 0, sizeof(struct esb_profile));
+
+    return esb_profile_changed(dev);
+}
+
+int zmk_esb_set_address(const struct zmk_esb_address *address) {
+    const struct device *dev = esb_transport_default();
+    struct esb_transport_data *data = dev->data;
+
+    if (address == NULL) {
+        return -EINVAL;
+    }
+
+    esb_profile_active(data)->address = *address;
+
+    return esb_profile_changed(dev);
+}
+
+int zmk_esb_get_address(struct zmk_esb_address *address) {
+    struct esb_transport_data *data = esb_transport_default()->data;
+
+    if (address == NULL) {
+        return -EINVAL;
+    }
+
+    *address = esb_profile_active(data)->address;
+    return 0;
+}
+
+int zmk_esb_pair(void) {
+    const struct device *dev = esb_transport_default();
+
+    if (!esb_transport_is_connected(dev)) {
+        return -ENOTCONN;
+    }
+
+    LOG_INF("ESB pairing on profile %d", zmk_esb_active_profile_index());
+    return esb_transport_send_ctrl(dev, ESB_CTRL_PAIR, NULL, 0, K_FOREVER);
+}
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+// Keys are esb/<instance>/active and esb/<instance>/profiles/<index>
+static int esb_profile_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                                    void *cb_arg) {
+    const char *next;
+    char *end;
+
+    // esb/rate and esb/latency apply to all instances
+    if (settings_name_steq(name, "rate", &next) && !next) {
+        return esb_rate_settings_set(len, read_cb, cb_arg);
+    }
+
+    if (settings_name_steq(name, "latency", &next) && !next) {
+        return esb_power_settings_set(len, read_cb, cb_arg);
+    }
+
+    long inst = strtol(name, &end, 10);
+    if (end == name || *end != '/') {
+        return -ENOENT;
+    }
+
+    const struct device *dev = esb_transport_get(inst);
+    if (dev == NULL) {
+        return -ENOENT;
+    }
+
+    struct esb_transport_data *data = dev->data;
+    name = end + 1;
+
+    if (settings_name_steq(name, "active", &next) && !next) {
+        uint8_t active;
+
+        if (len != sizeof(active) || read_cb(cb_arg, &active, sizeof(active)) < 0) {
+            return -EINVAL;
+        }
+
+        if (active < CONFIG_ZMK_ESB_PROFILE_COUNT) {
+            data->profiles.active = active;
+        }
+        return 0;
+    }
+
+    if (settings_name_steq(name, "profiles", &next) && next) {
+        long idx = strtol(next, &end, 10);
+        if (end == next || *end != '\0' || idx < 0 || idx >= CONFIG_ZMK_ESB_PROFILE_COUNT) {
+            return -ENOENT;
+        }
+
+        if (len != sizeof(struct esb_profile) ||
+            read_cb(cb_arg, &data->profiles.list[idx], sizeof(struct esb_profile)) < 0) {
+            return -EINVAL;
+        }
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+// Profiles may load after BLESB already confirmed ESB mode
+static int esb_profile_settings_commit(void) {
+    const struct device *dev;
+
+    esb_rate_settings_commit();
+    esb_power_settings_commit();
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        if (esb_transport_is_connected(dev)) {
+            esb_profile_sync(dev);
+        }
+    }
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(esb, "esb", NULL, esb_profile_settings_set,
+                               esb_profile_settings_commit, NULL);
+#endif
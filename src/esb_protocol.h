@@ -0,0 +1,251 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+// PRIM <-> BLESB UART framing
+//
+// Binary frames are [type:1][length:1][payload:length]. Frame types are always
+// below 0x40 and text messages always start with an uppercase letter, so the
+// first byte tells a binary frame from a text line ("ESB\n", "RST\n").
+#define ESB_FRAME_TYPE_MAX 0x3F
+
+// HID packet header structure
+struct hid_packet_header {
+    uint8_t type;      // HID_PACKET_TYPE_*, ESB_CTRL_* or ESB_EVT_*
+    uint8_t length;    // Payload length
+} __packed;
+
+// HID packet types
+#define HID_PACKET_TYPE_KEYBOARD ZMK_ESB_REPORT_KEYBOARD
+#define HID_PACKET_TYPE_CONSUMER ZMK_ESB_REPORT_CONSUMER
+#define HID_PACKET_TYPE_MOUSE    ZMK_ESB_REPORT_MOUSE
+
+// Control messages, PRIM -> BLESB
+#define ESB_CTRL_PIPE_CONFIG    0x10
+#define ESB_CTRL_CHANNEL_LIST   0x11
+#define ESB_CTRL_CHANNEL_SWITCH 0x12
+#define ESB_CTRL_PROFILE        0x15
+#define ESB_CTRL_PAIR           0x16
+#define ESB_CTRL_CAPS_QUERY     0x18
+#define ESB_FRAME_BATCH         0x1A
+#define ESB_CTRL_BAUD           0x1E
+#define ESB_CTRL_DFU_START      0x20
+#define ESB_FRAME_DFU_DATA      0x21
+#define ESB_CTRL_DFU_FINISH     0x22
+#define ESB_CTRL_TIME_SYNC      0x25
+#define ESB_CTRL_REPORT_RATE    0x27
+#define ESB_CTRL_POWER          0x28
+#define ESB_FRAME_SEQUENCED     0x29
+#define ESB_CTRL_LINK_TIMEOUT   0x2A
+#define ESB_FRAME_TIMED         0x2C
+
+// Both directions
+#define ESB_FRAME_FRAGMENT      0x1B
+#define ESB_FRAME_BULK_DATA     0x1C
+#define ESB_FRAME_BULK_ACK      0x1D
+
+// Events, BLESB -> PRIM
+#define ESB_EVT_CHANNEL_STATS   0x13
+#define ESB_EVT_CHANNEL_ACTIVE  0x14
+#define ESB_EVT_PAIRED          0x17
+#define ESB_EVT_CAPS            0x19
+#define ESB_EVT_BAUD            0x1F
+#define ESB_EVT_DFU_STATUS      0x23
+#define ESB_EVT_HID_OUTPUT      0x24
+#define ESB_EVT_TIME_SYNC       0x26
+#define ESB_EVT_LINK            0x2B
+#define ESB_EVT_TIMING          0x2D
+
+// Route one report type onto an ESB pipe
+struct esb_ctrl_pipe_config {
+    uint8_t report_type;
+    uint8_t pipe;
+    uint8_t retransmit_count;
+    uint16_t retransmit_delay_us;  // Little endian
+} __packed;
+
+// Channel list: [count][channel...], followed by ESB_CTRL_CHANNEL_SWITCH to the
+// channel to start on. BLESB announces a switch to the dongle before hopping and
+// confirms it with ESB_EVT_CHANNEL_ACTIVE: [channel].
+struct esb_ctrl_channel_switch {
+    uint8_t channel;
+} __packed;
+
+// One entry per channel in ESB_EVT_CHANNEL_STATS, counts since the last report
+struct esb_evt_channel_stats {
+    uint8_t channel;
+    uint16_t attempts;             // Little endian
+    uint16_t failures;             // Little endian, attempts that needed a retransmit
+} __packed;
+
+// Dongle address and last-known channel, restored in one message on connect so
+// reconnecting is a single round trip. An all-zero address means unpaired.
+// ESB_CTRL_PAIR (no payload) starts pairing; BLESB reports the result with
+// ESB_EVT_PAIRED carrying the same payload.
+struct esb_ctrl_profile {
+    uint8_t base_addr_0[4];
+    uint8_t base_addr_1[4];
+    uint8_t prefixes[8];
+    uint8_t channel;
+} __packed;
+
+// ESB_EVT_CAPS, BLESB's answer to ESB_CTRL_CAPS_QUERY (no payload). Until it
+// arrives, frames are limited to the classic 32-byte ESB payload.
+#define ESB_PAYLOAD_LEGACY 32
+
+#define ESB_CAPS_BATCH BIT(0)      // Understands ESB_FRAME_BATCH
+#define ESB_CAPS_FRAGMENT BIT(1)   // Understands ESB_FRAME_FRAGMENT
+#define ESB_CAPS_SEQUENCED BIT(2)  // Dongle deduplicates ESB_FRAME_SEQUENCED
+#define ESB_CAPS_TIMING BIT(3)     // Understands ESB_FRAME_TIMED
+
+struct esb_evt_caps {
+    uint8_t version;
+    uint8_t max_payload;           // Largest dynamic payload length of the radio
+    uint8_t flags;                 // ESB_CAPS_*
+} __packed;
+
+// ESB_FRAME_BATCH carries several complete frames back to back and is sent by
+// BLESB as a single ESB payload.
+
+// ESB_FRAME_FRAGMENT splits the message [type][payload...] of a frame too large
+// for one ESB payload. Fragments are sent back to back in index order without
+// per-fragment acknowledgement; the receiver drops a partial message when the
+// next fragment does not follow in order or within its reassembly timeout.
+struct esb_frag_header {
+    uint8_t msg_id;
+    uint8_t index;
+    uint8_t count;
+} __packed;
+
+// Bulk channel: a reliable byte stream for configuration traffic. Each
+// ESB_FRAME_BULK_DATA segment carries seq followed by data; the receiver accepts
+// segments in order only and answers with a cumulative ESB_FRAME_BULK_ACK whose
+// seq is the next segment it expects. The sender keeps a window of unacknowledged
+// segments in flight and goes back to the oldest one on a retransmit timeout.
+// Both directions start over at seq 0 each time BLESB confirms ESB mode.
+struct esb_bulk_header {
+    uint16_t seq;                  // Little endian
+} __packed;
+
+// ESB_FRAME_SEQUENCED wraps a HID report [type][report...] that is sent more
+// than once. BLESB forwards every copy as its own ESB payload; the dongle
+// delivers the first copy of each sequence number and drops the rest.
+struct esb_seq_header {
+    uint8_t seq;
+    uint8_t type;                  // HID_PACKET_TYPE_*
+} __packed;
+
+// ESB_FRAME_TIMED wraps a HID report [type][report...] to time its way to the
+// host. BLESB strips the header before the radio and, once the dongle has
+// reported in a later ACK payload how long the report waited for USB, echoes
+// ESB_EVT_TIMING. All durations are measured on the clock of the side taking
+// them, so none of it needs the clocks in sync.
+struct esb_timed_header {
+    uint32_t stamp;                // Little endian, PRIM cycle count as the report was sent
+    uint16_t queue_us;             // Little endian, time in PRIM's frame queue
+    uint8_t type;                  // HID_PACKET_TYPE_*
+} __packed;
+
+struct esb_evt_timing {
+    uint32_t stamp;                // Little endian, echoed
+    uint16_t queue_us;             // Little endian, echoed
+    uint16_t held_us;              // Little endian, from the report's last byte in to this event's first byte out
+    uint16_t radio_us;             // Little endian, from the report's last byte in to its ESB ACK
+    uint16_t usb_us;               // Little endian, from dongle radio RX to the USB IN transfer
+} __packed;
+
+// PRIM silence after which BLESB sends empty reports to the dongle by itself,
+// 0 to never. Any byte from PRIM restarts the timer, which stops while BLESB
+// sleeps.
+struct esb_ctrl_link_timeout {
+    uint16_t timeout_ms;           // Little endian
+} __packed;
+
+// Radio link to the dongle, reported lost once a payload exhausts its
+// retransmits and up again at the next ACK. BLESB drops what it cannot send
+// meanwhile.
+struct esb_evt_link {
+    uint8_t up;
+    uint16_t last_ack_ms;          // Little endian, age of the last ACK when lost
+} __packed;
+
+// ESB_EVT_HID_OUTPUT, a host output report. The dongle returns it in the ACK
+// payload of the next keyboard frame after the host changes it, and once more
+// after (re)connecting, so it costs no extra radio transaction.
+struct esb_evt_hid_output {
+    uint8_t leds;                  // HID LED page bits: Num, Caps, Scroll, ...
+} __packed;
+
+// Report rate profile. BLESB paces ESB payloads to the interval and the dongle
+// polls, or is polled by, its USB host at it.
+struct esb_ctrl_report_rate {
+    uint16_t interval_us;          // Little endian
+} __packed;
+
+// Latency mode. In performance mode BLESB keeps its radio and UART ready at all
+// times; in efficiency mode it may duty-cycle them between packets, and sleeps
+// on ESB_POWER_SLEEP until woken by a pulse on its wake line or an edge on its
+// UART RX, after which it receives again within CONFIG_ZMK_ESB_WAKE_TIME_US.
+#define ESB_POWER_PERFORMANCE 0
+#define ESB_POWER_EFFICIENCY 1
+#define ESB_POWER_SLEEP 2
+
+struct esb_ctrl_power {
+    uint8_t mode;                  // ESB_POWER_*
+} __packed;
+
+// Dongle USB poll phase. The dongle preloads each ACK payload with the time of
+// its latest USB SOF and the receive time of the previous packet, both on its
+// own clock; BLESB pairs the latter with its own transmit time of that packet to
+// map the SOF onto its clock. ESB_CTRL_TIME_SYNC sets how often BLESB reports
+// the result with ESB_EVT_TIME_SYNC, 0 to stop.
+struct esb_ctrl_time_sync {
+    uint16_t period_ms;            // Little endian
+} __packed;
+
+struct esb_evt_time_sync {
+    uint16_t sof_age_us;           // Little endian, SOF age as this frame's last byte leaves BLESB
+    uint16_t interval_us;          // Little endian, USB poll interval
+} __packed;
+
+// UART rate change, used for firmware updates. ESB_CTRL_BAUD proposes a rate;
+// ESB_EVT_BAUD answers with the highest supported rate not above it, or 0 to
+// stay. BLESB switches once its answer is on the wire, PRIM once it has received
+// it and drained its own queue.
+struct esb_ctrl_baud {
+    uint32_t baudrate;             // Little endian
+} __packed;
+
+// BLESB firmware update. ESB_CTRL_DFU_START puts BLESB in update mode for an
+// image; it answers with ESB_EVT_DFU_STATUS whose offset is where to resume, 0
+// unless part of the same image (size and CRC) was already received. Each
+// ESB_FRAME_DFU_DATA chunk carries its offset and CRC followed by data and is
+// consumed by BLESB itself, so chunks are limited by the UART frame rather than
+// the ESB payload. BLESB acknowledges chunks cumulatively and asks for a resend
+// from offset on a CRC or ordering error. ESB_CTRL_DFU_FINISH (no payload) makes
+// it verify the whole image and reboot into it, announcing ESB mode once up.
+//
+// BLESB leaves update mode on an "ESB\n" query, keeping what it received for a
+// later resume, and drops back to its base UART rate and announces ESB mode
+// again when the link stays silent for a second.
+struct esb_ctrl_dfu_start {
+    uint32_t image_size;           // Little endian
+    uint32_t image_crc;            // Little endian, CRC-32/IEEE of the image
+} __packed;
+
+struct esb_dfu_chunk_header {
+    uint32_t offset;               // Little endian
+    uint32_t crc;                  // Little endian, CRC-32/IEEE of the chunk data
+} __packed;
+
+#define ESB_DFU_STATUS_OK 0        // Offset is the next byte expected
+#define ESB_DFU_STATUS_RESEND 1    // Resend everything from offset
+#define ESB_DFU_STATUS_DONE 2      // Image verified, BLESB reboots into it
+#define ESB_DFU_STATUS_ERROR 3     // Image rejected
+
+struct esb_evt_dfu_status {
+    uint8_t status;                // ESB_DFU_STATUS_*
+    uint32_t offset;               // Little endian
+} __packed;
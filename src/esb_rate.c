@@ -0,0 +1,272 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/hid.h>
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_REPORT_RATE_DEFAULT_8KHZ)
+#define ESB_RATE_DEFAULT ZMK_ESB_REPORT_RATE_8KHZ
+#elif IS_ENABLED(CONFIG_ZMK_ESB_REPORT_RATE_DEFAULT_4KHZ)
+#define ESB_RATE_DEFAULT ZMK_ESB_REPORT_RATE_4KHZ
+#elif IS_ENABLED(CONFIG_ZMK_ESB_REPORT_RATE_DEFAULT_2KHZ)
+#define ESB_RATE_DEFAULT ZMK_ESB_REPORT_RATE_2KHZ
+#else
+#define ESB_RATE_DEFAULT ZMK_ESB_REPORT_RATE_1KHZ
+#endif
+
+static const uint16_t esb_rate_interval_us[ZMK_ESB_REPORT_RATE_COUNT] = {
+    [ZMK_ESB_REPORT_RATE_1KHZ] = 1000,
+    [ZMK_ESB_REPORT_RATE_2KHZ] = 500,
+    [ZMK_ESB_REPORT_RATE_4KHZ] = 250,
+    [ZMK_ESB_REPORT_RATE_8KHZ] = 125,
+};
+
+static enum zmk_esb_report_rate esb_rate = ESB_RATE_DEFAULT;
+
+static int esb_rate_send(const struct device *dev, k_timeout_t timeout) {
+    struct esb_ctrl_report_rate msg = {
+        .interval_us = sys_cpu_to_le16(esb_rate_interval_us[esb_rate]),
+    };
+
+    return esb_transport_send_ctrl(dev, ESB_CTRL_REPORT_RATE, &msg, sizeof(msg), timeout);
+}
+
+static void esb_rate_apply(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    data->rate.gap = k_us_to_cyc_ceil32(esb_rate_interval_us[esb_rate]);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+// Accumulate relative motion, saturating at the range of the report field
+#define ESB_RATE_ADD_MOTION(acc, delta)                                                            \
+    ((acc) = CLAMP((int32_t)(acc) + (delta), sizeof(acc) == 1 ? INT8_MIN : INT16_MIN,            \
+                   sizeof(acc) == 1 ? INT8_MAX : INT16_MAX))
+
+void esb_rate_mouse_merge(struct zmk_hid_mouse_report *acc,
+                          const struct zmk_hid_mouse_report *report) {
+    ESB_RATE_ADD_MOTION(acc->body.d_x, report->body.d_x);
+    ESB_RATE_ADD_MOTION(acc->body.d_y, report->body.d_y);
+    ESB_RATE_ADD_MOTION(acc->body.d_scroll_y, report->body.d_scroll_y);
+    ESB_RATE_ADD_MOTION(acc->body.d_scroll_x, report->body.d_scroll_x);
+}
+
+// Window over: queue the merged motion, or retry once the frame queue has room
+static void esb_rate_mouse_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, rate.mouse_work);
+
+    esb_power_activity(data->dev, true);
+
+    k_spinlock_key_t key = k_spin_lock(&data->rate.lock);
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    // Out of tokens: stays merged until the refill timer kicks it again
+    if (data->rate.mouse_pending && !esb_limit_take(data->dev, HID_PACKET_TYPE_MOUSE)) {
+        k_spin_unlock(&data->rate.lock, key);
+        return;
+    }
+#endif
+
+    if (data->rate.mouse_pending) {
+        int err = esb_hid_enqueue(data->dev, HID_PACKET_TYPE_MOUSE,
+                                  (const uint8_t *)&data->rate.mouse, sizeof(data->rate.mouse),
+                                  data->rate.mouse_stamp, K_NO_WAIT);
+        if (err) {
+            k_work_schedule(&data->rate.mouse_work,
+                            K_TICKS(k_cyc_to_ticks_ceil32(data->rate.gap)));
+        } else {
+            data->rate.mouse_pending = false;
+            data->rate.mouse_last = k_cycle_get_32();
+        }
+    }
+
+    k_spin_unlock(&data->rate.lock, key);
+
+    esb_hid_flush(data->dev);
+}
+
+// Mouse frames leave at most once per report interval; motion arriving in
+// between is merged and sent when the window closes. Button changes are never
+// merged: pending motion is queued first, then the new report goes out at once.
+// Returns 1 when the report was deferred, 0 when it should be queued now, or
+// -EAGAIN when the queue has no room for the pending motion ahead of it.
+int esb_rate_mouse_defer(const struct device *dev, const struct zmk_hid_mouse_report *report,
+                         uint32_t stamp) {
+    struct esb_transport_data *data = dev->data;
+    bool flushed = false;
+    int ret = 0;
+    uint32_t now = k_cycle_get_32();
+
+    k_spinlock_key_t key = k_spin_lock(&data->rate.lock);
+
+    if (data->rate.mouse_pending) {
+        if (data->rate.mouse.body.buttons == report->body.buttons) {
+            esb_rate_mouse_merge(&data->rate.mouse, report);
+            atomic_inc(&data->rate.merged);
+            ret = 1;
+        } else if (esb_hid_enqueue(dev, HID_PACKET_TYPE_MOUSE, (const uint8_t *)&data->rate.mouse,
+                                   sizeof(data->rate.mouse), data->rate.mouse_stamp,
+                                   K_NO_WAIT) == 0) {
+            flushed = true;
+            data->rate.mouse_pending = false;
+            data->rate.mouse_last = now;
+        } else {
+            // The motion stays pending so it still goes out before the buttons
+            ret = -EAGAIN;
+        }
+    } else if (now - data->rate.mouse_last < data->rate.gap) {
+        uint32_t wait = data->rate.gap - (now - data->rate.mouse_last);
+
+        data->rate.mouse = *report;
+        data->rate.mouse_stamp = stamp;
+        data->rate.mouse_pending = true;
+        k_work_schedule(&data->rate.mouse_work, K_TICKS(k_cyc_to_ticks_ceil32(wait)));
+        ret = 1;
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    } else if (!esb_limit_take(dev, HID_PACKET_TYPE_MOUSE)) {
+        // Over budget: merged until the refill timer hands out a token
+        data->rate.mouse = *report;
+        data->rate.mouse_stamp = stamp;
+        data->rate.mouse_pending = true;
+        atomic_inc(&data->limit.limited[HID_PACKET_TYPE_MOUSE - 1]);
+        ret = 1;
+#endif
+    } else {
+        data->rate.mouse_last = now;
+    }
+
+    k_spin_unlock(&data->rate.lock, key);
+
+    if (flushed) {
+        k_work_cancel_delayable(&data->rate.mouse_work);
+    }
+
+    return ret;
+}
+
+// Drop motion waiting in the merge window
+void esb_rate_mouse_reset(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->rate.lock);
+    data->rate.mouse_pending = false;
+    k_spin_unlock(&data->rate.lock, key);
+
+    k_work_cancel_delayable(&data->rate.mouse_work);
+}
+#endif
+
+void esb_rate_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    esb_rate_apply(dev);
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    data->rate.mouse_pending = false;
+    data->rate.mouse_last = k_cycle_get_32() - data->rate.gap;
+    atomic_set(&data->rate.merged, 0);
+    atomic_set(&data->rate.expired, 0);
+    k_work_init_delayable(&data->rate.mouse_work, esb_rate_mouse_work);
+#else
+    ARG_UNUSED(data);
+#endif
+}
+
+int esb_rate_sync(const struct device *dev) { return esb_rate_send(dev, K_NO_WAIT); }
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+static void esb_rate_save_work(struct k_work *work) {
+    uint8_t rate = esb_rate;
+
+    int err = settings_save_one("esb/rate", &rate, sizeof(rate));
+    if (err) {
+        LOG_ERR("Failed to save ESB report rate (%d)", err);
+    }
+}
+
+static K_WORK_DELAYABLE_DEFINE(esb_rate_save, esb_rate_save_work);
+
+int esb_rate_settings_set(size_t len, settings_read_cb read_cb, void *cb_arg) {
+    uint8_t rate;
+
+    if (len != sizeof(rate) || read_cb(cb_arg, &rate, sizeof(rate)) < 0) {
+        return -EINVAL;
+    }
+
+    if (rate < ZMK_ESB_REPORT_RATE_COUNT) {
+        esb_rate = rate;
+    }
+    return 0;
+}
+
+// Apply a rate loaded from settings after the instances came up
+void esb_rate_settings_commit(void) {
+    const struct device *dev;
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        esb_rate_apply(dev);
+        if (esb_transport_is_connected(dev)) {
+            esb_rate_sync(dev);
+        }
+    }
+}
+#endif
+
+int zmk_esb_set_report_rate(enum zmk_esb_report_rate rate) {
+    const struct device *dev;
+    int ret = 0;
+
+    if (rate >= ZMK_ESB_REPORT_RATE_COUNT) {
+        return -EINVAL;
+    }
+
+    if (rate == esb_rate) {
+        return 0;
+    }
+
+    esb_rate = rate;
+    LOG_INF("ESB report rate: %d us", esb_rate_interval_us[rate]);
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        esb_rate_apply(dev);
+        if (esb_transport_is_connected(dev)) {
+            int err = esb_rate_send(dev, K_FOREVER);
+            if (err) {
+                ret = err;
+            }
+        }
+    }
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+    k_work_reschedule(&esb_rate_save, K_MSEC(CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE));
+#endif
+
+    return ret;
+}
+
+enum zmk_esb_report_rate zmk_esb_get_report_rate(void) { return esb_rate; }
+
+uint16_t zmk_esb_get_report_interval_us(void) { return esb_rate_interval_us[esb_rate]; }
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+int zmk_esb_get_pointer_stats(struct zmk_esb_pointer_stats *stats) {
+    struct esb_transport_data *data = esb_transport_pointing()->data;
+
+    if (stats == NULL) {
+        return -EINVAL;
+    }
+
+    stats->merged = atomic_get(&data->rate.merged);
+    stats->expired = atomic_get(&data->rate.expired);
+    return 0;
+}
+#endif
@@ -0,0 +1,108 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/hid.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Second copy of the latest state change. Best effort: dropped when the frame
+// queue is full, as the first copy is already on its way.
+static void esb_redundant_copy_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, redundant.copy_work);
+    const struct device *dev = data->dev;
+    uint8_t msg[sizeof(data->redundant.copy)];
+
+    k_spinlock_key_t key = k_spin_lock(&data->redundant.lock);
+    uint8_t len = data->redundant.copy_len;
+    memcpy(msg, data->redundant.copy, len);
+    data->redundant.copy_len = 0;
+    k_spin_unlock(&data->redundant.lock, key);
+
+    if (len == 0 || !esb_transport_is_connected(dev)) {
+        return;
+    }
+
+    esb_power_activity(dev, false);
+    if (esb_hid_enqueue(dev, ESB_FRAME_SEQUENCED, msg, len, k_cycle_get_32(), K_NO_WAIT) == 0) {
+        esb_hid_flush(dev);
+    }
+}
+
+void esb_redundant_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    data->redundant.seq = 0;
+    data->redundant.copy_len = 0;
+    memset(data->redundant.last, 0, sizeof(data->redundant.last));
+    k_work_init_delayable(&data->redundant.copy_work, esb_redundant_copy_work);
+}
+
+// Drop a pending second copy and forget the last state, so the next report is
+// sent as a state change
+void esb_redundant_reset(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->redundant.lock);
+    data->redundant.copy_len = 0;
+    memset(data->redundant.last, 0, sizeof(data->redundant.last));
+    k_spin_unlock(&data->redundant.lock, key);
+
+    k_work_cancel_delayable(&data->redundant.copy_work);
+}
+
+// Queue a keyboard report, sequenced and followed by a delayed second copy when
+// it changes the pressed keys and the dongle can deduplicate
+int esb_redundant_send(const struct device *dev, const uint8_t *report, size_t len,
+                       uint32_t stamp) {
+    struct esb_transport_data *data = dev->data;
+    uint8_t msg[sizeof(data->redundant.copy)];
+    struct esb_seq_header *header = (struct esb_seq_header *)msg;
+    size_t msg_len = sizeof(*header) + len;
+
+    if (!(data->caps & ESB_CAPS_SEQUENCED) || len > sizeof(data->redundant.last) ||
+        (sizeof(struct hid_packet_header) + msg_len > data->max_payload &&
+         !(data->caps & ESB_CAPS_FRAGMENT))) {
+        return esb_hid_enqueue(dev, HID_PACKET_TYPE_KEYBOARD, report, len, stamp, K_NO_WAIT);
+    }
+
+    uint8_t prev[sizeof(data->redundant.last)];
+    k_spinlock_key_t key = k_spin_lock(&data->redundant.lock);
+
+    bool changed = memcmp(data->redundant.last, report, len) != 0;
+    if (changed) {
+        memcpy(prev, data->redundant.last, len);
+        memcpy(data->redundant.last, report, len);
+        header->seq = ++data->redundant.seq;
+        header->type = HID_PACKET_TYPE_KEYBOARD;
+        memcpy(&msg[sizeof(*header)], report, len);
+
+        // A copy of an older state still waiting is superseded by this one
+        memcpy(data->redundant.copy, msg, msg_len);
+        data->redundant.copy_len = msg_len;
+    }
+
+    k_spin_unlock(&data->redundant.lock, key);
+
+    if (!changed) {
+        return esb_hid_enqueue(dev, HID_PACKET_TYPE_KEYBOARD, report, len, stamp, K_NO_WAIT);
+    }
+
+    int err = esb_hid_enqueue(dev, ESB_FRAME_SEQUENCED, msg, msg_len, stamp, K_NO_WAIT);
+    if (err == 0) {
+        k_work_reschedule(&data->redundant.copy_work, K_USEC(CONFIG_ZMK_ESB_REDUNDANT_DELAY_US));
+    } else {
+        // Not sent: the resubmitted state must count as a change again
+        key = k_spin_lock(&data->redundant.lock);
+        memcpy(data->redundant.last, prev, len);
+        data->redundant.copy_len = 0;
+        k_spin_unlock(&data->redundant.lock, key);
+    }
+
+    return err;
+}
@@ -0,0 +1,143 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/event_manager.h>
+#include <zmk/events/endpoint_changed.h>
+#include <zmk/hid.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Empty reports, ready to queue as they are
+static const struct esb_frame esb_release_keyboard = {
+    .len = sizeof(struct hid_packet_header) + sizeof(struct zmk_hid_keyboard_report_body),
+    .data = {HID_PACKET_TYPE_KEYBOARD, sizeof(struct zmk_hid_keyboard_report_body)},
+};
+
+static const struct esb_frame esb_release_consumer = {
+    .len = sizeof(struct hid_packet_header) + sizeof(struct zmk_hid_consumer_report),
+    .data = {HID_PACKET_TYPE_CONSUMER, sizeof(struct zmk_hid_consumer_report),
+             ZMK_HID_REPORT_ID_CONSUMER},
+};
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+static const struct esb_frame esb_release_mouse = {
+    .len = sizeof(struct hid_packet_header) + sizeof(struct zmk_hid_mouse_report),
+    .data = {HID_PACKET_TYPE_MOUSE, sizeof(struct zmk_hid_mouse_report), ZMK_HID_REPORT_ID_MOUSE},
+};
+#endif
+
+static const struct esb_frame *const esb_release_frames[ZMK_ESB_REPORT_TYPE_COUNT] = {
+    [ZMK_ESB_REPORT_KEYBOARD - 1] = &esb_release_keyboard,
+    [ZMK_ESB_REPORT_CONSUMER - 1] = &esb_release_consumer,
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    [ZMK_ESB_REPORT_MOUSE - 1] = &esb_release_mouse,
+#endif
+};
+
+// Release everything routed through an instance ahead of anything queued,
+// which is dropped along with pending merged motion and redundant copies.
+// Safe from the UART ISR.
+void esb_release_all(const struct device *dev) {
+    struct esb_frame frames[ZMK_ESB_REPORT_TYPE_COUNT];
+    size_t count = 0;
+
+    for (int type = 1; type <= ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+        if (esb_release_frames[type - 1] != NULL && esb_transport_for_report(type) == dev) {
+            frames[count++] = *esb_release_frames[type - 1];
+        }
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    esb_rate_mouse_reset(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    esb_limit_reset(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_REPLAY)
+    esb_replay_reset(dev);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_REDUNDANT_KEYS)
+    esb_redundant_reset(dev);
+#endif
+
+    esb_hid_preempt(dev, frames, count);
+    LOG_DBG("ESB release-all (%s)", dev->name);
+}
+
+#if CONFIG_ZMK_ESB_LINK_TIMEOUT_MS > 0
+static bool esb_release_keys_held(void) {
+    const struct zmk_hid_keyboard_report *keyboard = zmk_hid_get_keyboard_report();
+    const struct zmk_hid_consumer_report *consumer = zmk_hid_get_consumer_report();
+
+    return memcmp(&keyboard->body, &esb_release_keyboard.data[sizeof(struct hid_packet_header)],
+                  sizeof(keyboard->body)) != 0 ||
+           memcmp(consumer, &esb_release_consumer.data[sizeof(struct hid_packet_header)],
+                  sizeof(*consumer)) != 0;
+}
+
+// BLESB releases everything when PRIM stays silent for the link timeout, so
+// keys held without new reports need a heartbeat
+static void esb_release_keepalive_work(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(esb_release_keepalive, esb_release_keepalive_work);
+
+static void esb_release_keepalive_work(struct k_work *work) {
+    const struct device *dev = esb_transport_default();
+
+    // BLESB stops its timer while asleep; the next report restarts this
+    if (!esb_transport_is_connected(dev) || !esb_power_is_awake(dev) ||
+        !esb_release_keys_held()) {
+        return;
+    }
+
+    // An empty line is ignored by BLESB but resets its timer
+    esb_power_tx_get(dev);
+    esb_transport_tx(dev, (const uint8_t *)"\n", 1, K_NO_WAIT);
+    k_work_schedule(&esb_release_keepalive, K_MSEC(CONFIG_ZMK_ESB_LINK_TIMEOUT_MS / 2));
+}
+
+// Called as keyboard or consumer reports are sent
+void esb_release_note_report(void) {
+    k_work_reschedule(&esb_release_keepalive, K_MSEC(CONFIG_ZMK_ESB_LINK_TIMEOUT_MS / 2));
+}
+#endif
+
+int esb_release_sync(const struct device *dev) {
+    struct esb_ctrl_link_timeout msg = {
+        .timeout_ms = sys_cpu_to_le16(CONFIG_ZMK_ESB_LINK_TIMEOUT_MS),
+    };
+
+    return esb_transport_send_ctrl(dev, ESB_CTRL_LINK_TIMEOUT, &msg, sizeof(msg), K_NO_WAIT);
+}
+
+// The endpoint moving away from ESB leaves the dongle with whatever was held
+static int esb_release_listener(const zmk_event_t *eh) {
+    const struct zmk_endpoint_changed *ev = as_zmk_endpoint_changed(eh);
+    const struct device *dev;
+
+    if (ev == NULL) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
+
+    bool selected = ev->endpoint.transport == ZMK_TRANSPORT_ESB;
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+        bool was_selected = data->selected;
+
+        data->selected = selected;
+        if (was_selected && !selected && esb_transport_is_connected(dev)) {
+            esb_power_activity(dev, false);
+            esb_release_all(dev);
+        }
+    }
+
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(esb_release, esb_release_listener);
+ZMK_SUBSCRIPTION(esb_release, zmk_endpoint_changed);
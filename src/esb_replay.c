@@ -0,0 +1,285 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include <dt-bindings/zmk/hid_usage.h>
+#include <dt-bindings/zmk/hid_usage_pages.h>
+
+#include <zmk/event_manager.h>
+#include <zmk/events/keycode_state_changed.h>
+#include <zmk/hid.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// One key state transition, kept whether or not the link is up since a loss is
+// only reported after the fact
+struct esb_replay_entry {
+    uint32_t time;                // Uptime in ms
+    uint8_t usage;                // Keyboard page
+    bool pressed;
+} __packed;
+
+static struct {
+    struct k_spinlock lock;
+    struct esb_replay_entry ring[CONFIG_ZMK_ESB_REPLAY_DEPTH];
+    uint8_t head;                 // Next slot written
+    uint8_t count;
+    bool lost;
+    uint32_t lost_since;          // Uptime of the last ACK before the loss
+    // Replay in progress: the next entry and the state it applies to
+    bool replaying;
+    uint8_t next;
+    uint8_t left;
+    struct zmk_hid_keyboard_report_body body;
+} esb_replay;
+
+static void esb_replay_work(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(esb_replay_resume, esb_replay_work);
+
+static const struct device *esb_replay_dev(void) {
+    return esb_transport_for_report(HID_PACKET_TYPE_KEYBOARD);
+}
+
+static uint8_t esb_replay_slot(int index) {
+    return (index + CONFIG_ZMK_ESB_REPLAY_DEPTH) % CONFIG_ZMK_ESB_REPLAY_DEPTH;
+}
+
+static void esb_replay_apply(struct zmk_hid_keyboard_report_body *body, uint8_t usage,
+                             bool pressed) {
+    if (usage >= HID_USAGE_KEY_KEYBOARD_LEFTCONTROL && usage <= HID_USAGE_KEY_KEYBOARD_RIGHT_GUI) {
+        WRITE_BIT(body->modifiers, usage - HID_USAGE_KEY_KEYBOARD_LEFTCONTROL, pressed);
+        return;
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_NKRO)
+    if (usage / 8 < sizeof(body->keys)) {
+        WRITE_BIT(body->keys[usage / 8], usage % 8, pressed);
+    }
+#else
+    int free = -1;
+
+    for (int i = 0; i < ARRAY_SIZE(body->keys); i++) {
+        if (body->keys[i] == usage) {
+            if (!pressed) {
+                body->keys[i] = 0;
+            }
+            return;
+        }
+        if (body->keys[i] == 0 && free < 0) {
+            free = i;
+        }
+    }
+    if (pressed && free >= 0) {
+        body->keys[free] = usage;
+    }
+#endif
+}
+
+// Called with the lock held. Picks the transitions made since the last ACK and
+// rebuilds the state before the first of them by undoing them on the current
+// one. Returns false when they cannot all be replayed fresh.
+static bool esb_replay_prepare(uint32_t now) {
+    const struct zmk_hid_keyboard_report *keyboard = zmk_hid_get_keyboard_report();
+    uint8_t n = 0;
+
+    while (n < esb_replay.count &&
+           (int32_t)(esb_replay.ring[esb_replay_slot(esb_replay.head - n - 1)].time -
+                     esb_replay.lost_since) >= 0) {
+        n++;
+    }
+
+    // Transitions older than the ring reaches may have been overwritten
+    if (n == 0 || n == CONFIG_ZMK_ESB_REPLAY_DEPTH) {
+        return false;
+    }
+
+    uint8_t first = esb_replay_slot(esb_replay.head - n);
+    if (now - esb_replay.ring[first].time > CONFIG_ZMK_ESB_REPLAY_WINDOW_MS) {
+        return false;
+    }
+
+    esb_replay.body = keyboard->body;
+    for (uint8_t i = 1; i <= n; i++) {
+        const struct esb_replay_entry *entry = &esb_replay.ring[esb_replay_slot(esb_replay.head - i)];
+
+        esb_replay_apply(&esb_replay.body, entry->usage, !entry->pressed);
+    }
+
+    esb_replay.next = first;
+    esb_replay.left = n;
+    return true;
+}
+
+// Replay the transitions lost with the link in order, one keyboard frame each,
+// then send the current state, which also stands in for all of them when they
+// are too old or too many. Frames are queued with the lock dropped; a loss or
+// an overwritten entry meanwhile shows in the state rechecked afterwards.
+static void esb_replay_work(struct k_work *work) {
+    const struct device *dev = esb_replay_dev();
+    uint32_t now = k_uptime_get_32();
+
+    if (!esb_transport_is_connected(dev)) {
+        return;
+    }
+
+    esb_power_activity(dev, true);
+
+    k_spinlock_key_t key = k_spin_lock(&esb_replay.lock);
+
+    if (esb_replay.lost) {
+        k_spin_unlock(&esb_replay.lock, key);
+        return;
+    }
+
+    if (!esb_replay.replaying) {
+        esb_replay.replaying = true;
+        if (!esb_replay_prepare(now)) {
+            esb_replay.left = 0;
+            LOG_DBG("ESB link back, sending current state");
+        } else {
+            LOG_DBG("ESB link back, replaying %d transitions", esb_replay.left);
+        }
+    }
+
+    while (esb_replay.replaying && esb_replay.left > 0) {
+        const struct esb_replay_entry *entry = &esb_replay.ring[esb_replay.next];
+        struct zmk_hid_keyboard_report_body body = esb_replay.body;
+        uint8_t next = esb_replay.next;
+
+        esb_replay_apply(&body, entry->usage, entry->pressed);
+        k_spin_unlock(&esb_replay.lock, key);
+
+        int err = esb_hid_enqueue(dev, HID_PACKET_TYPE_KEYBOARD, (const uint8_t *)&body,
+                                  sizeof(body), k_cycle_get_32(), K_NO_WAIT);
+
+        key = k_spin_lock(&esb_replay.lock);
+        if (err) {
+            break;
+        }
+
+        if (esb_replay.replaying && esb_replay.left > 0 && esb_replay.next == next) {
+            esb_replay.body = body;
+            esb_replay.next = esb_replay_slot(next + 1);
+            esb_replay.left--;
+        }
+    }
+
+    bool finish = esb_replay.replaying && esb_replay.left == 0;
+    bool retry = esb_replay.replaying && !finish;
+    k_spin_unlock(&esb_replay.lock, key);
+
+    if (finish) {
+        const struct zmk_hid_keyboard_report *keyboard = zmk_hid_get_keyboard_report();
+        const struct zmk_hid_consumer_report *consumer = zmk_hid_get_consumer_report();
+        const struct device *consumer_dev = esb_transport_for_report(HID_PACKET_TYPE_CONSUMER);
+        uint32_t stamp = k_cycle_get_32();
+
+        if (esb_hid_enqueue(dev, HID_PACKET_TYPE_KEYBOARD, (const uint8_t *)&keyboard->body,
+                            sizeof(keyboard->body), stamp, K_NO_WAIT) == 0) {
+            esb_hid_enqueue(consumer_dev, HID_PACKET_TYPE_CONSUMER, (const uint8_t *)consumer,
+                            sizeof(*consumer), stamp, K_NO_WAIT);
+            if (consumer_dev != dev) {
+                esb_hid_flush(consumer_dev);
+            }
+
+            key = k_spin_lock(&esb_replay.lock);
+            esb_replay.replaying = false;
+            k_spin_unlock(&esb_replay.lock, key);
+
+            // Reports refused during the replay are covered by the state
+            // just sent; their senders may go on
+            esb_hid_notify_space(dev);
+        } else {
+            retry = true;
+        }
+    }
+
+    // Queue full: go on once the UART has taken some of it
+    if (retry) {
+        k_work_schedule(&esb_replay_resume, K_MSEC(1));
+    }
+
+    esb_hid_flush(dev);
+}
+
+// Called from the UART ISR as BLESB reports the radio link lost or back
+void esb_replay_handle_link(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    const struct esb_evt_link *evt = (const void *)payload;
+
+    if (len < sizeof(*evt) || dev != esb_replay_dev()) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&esb_replay.lock);
+
+    if (evt->up) {
+        if (esb_replay.lost) {
+            esb_replay.lost = false;
+            k_work_reschedule(&esb_replay_resume, K_NO_WAIT);
+        }
+    } else if (!esb_replay.lost) {
+        esb_replay.lost = true;
+        // Lost again mid-replay: what is left goes out as the current state
+        esb_replay.replaying = false;
+        esb_replay.lost_since = k_uptime_get_32() - sys_le16_to_cpu(evt->last_ack_ms);
+        LOG_DBG("ESB link lost, last ACK %d ms ago", sys_le16_to_cpu(evt->last_ack_ms));
+    }
+
+    k_spin_unlock(&esb_replay.lock, key);
+}
+
+// Keyboard and consumer reports are refused with -EAGAIN while the link is lost
+// or being replayed; the current state sent at the end of the replay covers
+// them, and their senders are told there is room again then
+bool esb_replay_hold(const struct device *dev) {
+    return dev == esb_replay_dev() && (esb_replay.lost || esb_replay.replaying);
+}
+
+// The link to BLESB itself went away: nothing is left to replay
+void esb_replay_reset(const struct device *dev) {
+    if (dev != esb_replay_dev()) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&esb_replay.lock);
+    esb_replay.lost = false;
+    esb_replay.replaying = false;
+    k_spin_unlock(&esb_replay.lock, key);
+
+    k_work_cancel_delayable(&esb_replay_resume);
+}
+
+static int esb_replay_listener(const zmk_event_t *eh) {
+    const struct zmk_keycode_state_changed *ev = as_zmk_keycode_state_changed(eh);
+
+    if (ev == NULL || ev->usage_page != HID_USAGE_KEY || ev->keycode > UINT8_MAX) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&esb_replay.lock);
+
+    // Overwriting a transition still to replay: the current state covers it
+    if (esb_replay.left > 0 && esb_replay.count == CONFIG_ZMK_ESB_REPLAY_DEPTH &&
+        esb_replay.head == esb_replay.next) {
+        esb_replay.left = 0;
+    }
+
+    esb_replay.ring[esb_replay.head] = (struct esb_replay_entry){
+        .time = (uint32_t)ev->timestamp,
+        .usage = (uint8_t)ev->keycode,
+        .pressed = ev->state,
+    };
+    esb_replay.head = esb_replay_slot(esb_replay.head + 1);
+    esb_replay.count = MIN(esb_replay.count + 1, CONFIG_ZMK_ESB_REPLAY_DEPTH);
+
+    k_spin_unlock(&esb_replay.lock, key);
+
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(esb_replay, esb_replay_listener);
+ZMK_SUBSCRIPTION(esb_replay, zmk_keycode_state_changed);
@@ -0,0 +1,87 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/hid.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Uptime of the latest report handed to the transport, in ms
+static atomic_t esb_resync_last;
+
+static void esb_resync_work(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(esb_resync, esb_resync_work);
+
+// Resync frames only ever fill an otherwise idle link, and never wake it
+static bool esb_resync_idle(const struct device *dev) {
+    const struct esb_transport_data *data = dev->data;
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_REPLAY)
+    // The state goes out at the end of the replay, not ahead of it
+    if (esb_replay_hold(dev)) {
+        return false;
+    }
+#endif
+
+    return data->hid.count == 0 && !esb_hid_pending(dev) && esb_transport_tx_pending(dev) == 0 &&
+           esb_power_is_awake(dev);
+}
+
+// Repeat the current keyboard and consumer state, so a lost release cannot
+// leave a key stuck on the host for longer than one period
+static void esb_resync_work(struct k_work *work) {
+    const struct device *dev = esb_transport_default();
+
+    // Started again once the link comes back
+    if (!esb_transport_is_connected(dev)) {
+        return;
+    }
+
+    uint32_t quiet = k_uptime_get_32() - (uint32_t)atomic_get(&esb_resync_last);
+    if (quiet < CONFIG_ZMK_ESB_RESYNC_PERIOD_MS) {
+        k_work_schedule(&esb_resync, K_MSEC(CONFIG_ZMK_ESB_RESYNC_PERIOD_MS - quiet));
+        return;
+    }
+
+    if (esb_resync_idle(dev)) {
+        // Snapshots go in the lowest lane and only if no live report was queued
+        // since before they were read; a later one takes them out of the queue
+        uint32_t live = esb_hid_live(dev);
+        struct zmk_hid_keyboard_report *keyboard = zmk_hid_get_keyboard_report();
+        struct zmk_hid_consumer_report *consumer = zmk_hid_get_consumer_report();
+
+        uint32_t stamp = k_cycle_get_32();
+        int queued = 0;
+
+        if (esb_hid_enqueue_resync(dev, HID_PACKET_TYPE_KEYBOARD,
+                                   (const uint8_t *)&keyboard->body, sizeof(keyboard->body), stamp,
+                                   live) == 0) {
+            queued++;
+        }
+        if (esb_hid_enqueue_resync(dev, HID_PACKET_TYPE_CONSUMER, (const uint8_t *)consumer,
+                                   sizeof(*consumer), stamp, live) == 0) {
+            queued++;
+        }
+
+        // Nothing reaches the UART before the flush, and only the ISR
+        // releases the reference once something has left it
+        if (queued > 0) {
+            esb_power_tx_get(dev);
+            esb_hid_flush(dev);
+        }
+    }
+
+    k_work_schedule(&esb_resync, K_MSEC(CONFIG_ZMK_ESB_RESYNC_PERIOD_MS));
+}
+
+void esb_resync_note_report(void) { atomic_set(&esb_resync_last, k_uptime_get_32()); }
+
+// Called from the UART ISR as BLESB confirms ESB mode
+void esb_resync_start(const struct device *dev) {
+    if (dev == esb_transport_default()) {
+        k_work_reschedule(&esb_resync, K_MSEC(CONFIG_ZMK_ESB_RESYNC_PERIOD_MS));
+    }
+}
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/shell/shell.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+#include <zmk_feature_esb_transport/esb_hid.h>
+
+#include "esb_transport.h"
+
+static const char *const esb_shell_types[ZMK_ESB_REPORT_TYPE_COUNT] = {
+    [ZMK_ESB_REPORT_KEYBOARD - 1] = "keyboard",
+    [ZMK_ESB_REPORT_CONSUMER - 1] = "consumer",
+    [ZMK_ESB_REPORT_MOUSE - 1] = "mouse",
+};
+
+static int cmd_esb_stats(const struct shell *sh, size_t argc, char **argv) {
+    struct zmk_esb_stats stats;
+    struct zmk_esb_hid_stats hid;
+
+    zmk_esb_get_stats(&stats);
+    zmk_esb_hid_get_stats(&hid);
+
+    shell_print(sh, "frames:      %u", stats.frames);
+    shell_print(sh, "tx bytes:    %u", stats.tx_bytes);
+    shell_print(sh, "rx bytes:    %u", stats.rx_bytes);
+    shell_print(sh, "dropped:     %u", stats.dropped);
+    shell_print(sh, "refused:     %u", stats.refused);
+    shell_print(sh, "suppressed:  %u", hid.suppressed);
+    shell_print(sh, "retransmits: %u", stats.retransmits);
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+    struct zmk_esb_pointer_stats pointer;
+
+    zmk_esb_get_pointer_stats(&pointer);
+    shell_print(sh, "merged:      %u", pointer.merged);
+    shell_print(sh, "expired:     %u", pointer.expired);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    for (int type = 0; type < ZMK_ESB_REPORT_TYPE_COUNT; type++) {
+        if (hid.buckets[type].burst > 0) {
+            shell_print(sh, "limited %-9s %u (%u/%u tokens)", esb_shell_types[type],
+                        hid.buckets[type].limited, hid.buckets[type].tokens,
+                        hid.buckets[type].burst);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+static int cmd_esb_link(const struct shell *sh, size_t argc, char **argv) {
+    const struct device *dev;
+    uint8_t channels[ZMK_ESB_CHANNELS_MAX];
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        const struct esb_transport_data *data = dev->data;
+
+        shell_print(sh, "%s: %s, payload %u, caps 0x%02x, %s", dev->name,
+                    esb_transport_is_connected(dev) ? "connected" : "not connected",
+                    data->max_payload, data->caps, esb_power_is_awake(dev) ? "awake" : "asleep");
+    }
+
+    int count = zmk_esb_get_channels(channels, sizeof(channels));
+    uint8_t active = zmk_esb_get_active_channel();
+
+    for (int i = 0; i < count; i++) {
+        shell_print(sh, "channel %3u: %4d permille failed%s", channels[i],
+                    zmk_esb_get_channel_failure_rate(channels[i]),
+                    channels[i] == active ? " (active)" : "");
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIME_SYNC)
+    struct zmk_esb_time_sync sync;
+
+    zmk_esb_get_time_sync(&sync);
+    if (sync.synced) {
+        shell_print(sh, "USB poll: %u us, jitter %u us", sync.interval_us, sync.jitter_us);
+    }
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIMING)
+    static const char *const stages[ZMK_ESB_STAGE_COUNT] = {"queue", "uart", "radio", "usb"};
+    struct zmk_esb_timing timing;
+
+    zmk_esb_get_timing(&timing);
+    for (int stage = 0; timing.samples > 0 && stage < ZMK_ESB_STAGE_COUNT; stage++) {
+        shell_print(sh, "%-5s: avg %u us, max %u us", stages[stage],
+                    timing.stages[stage].avg_us, timing.stages[stage].max_us);
+    }
+#endif
+
+    return 0;
+}
+
+static int cmd_esb_rate(const struct shell *sh, size_t argc, char **argv) {
+    if (argc > 1) {
+        unsigned long hz = strtoul(argv[1], NULL, 10);
+        int err = -EINVAL;
+
+        for (int rate = 0; rate < ZMK_ESB_REPORT_RATE_COUNT; rate++) {
+            if (hz == 1000U << rate) {
+                err = zmk_esb_set_report_rate(rate);
+                break;
+            }
+        }
+
+        if (err) {
+            shell_error(sh, "Failed to set %s Hz (%d), use 1000, 2000, 4000 or 8000", argv[1],
+                        err);
+            return err;
+        }
+    }
+
+    shell_print(sh, "%u Hz (%u us)", 1000U << zmk_esb_get_report_rate(),
+                zmk_esb_get_report_interval_us());
+    return 0;
+}
+
+// Read only: BLESB only agrees to another UART rate for a firmware update
+static int cmd_esb_baud(const struct shell *sh, size_t argc, char **argv) {
+    const struct device *dev;
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        uint32_t baudrate;
+        int err = esb_transport_get_baud(dev, &baudrate);
+
+        if (err) {
+            shell_print(sh, "%s: unknown (%d)", dev->name, err);
+        } else {
+            shell_print(sh, "%s: %u", dev->name, baudrate);
+        }
+    }
+
+    return 0;
+}
+
+static int cmd_esb_reset_stats(const struct shell *sh, size_t argc, char **argv) {
+    zmk_esb_reset_stats();
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+static const char *const esb_shell_hists[ZMK_ESB_HIST_COUNT] = {
+    [ZMK_ESB_HIST_SEND] = "send",
+    [ZMK_ESB_HIST_QUEUE] = "queue",
+    [ZMK_ESB_HIST_WIRE] = "wire",
+};
+
+static int cmd_esb_hist(const struct shell *sh, size_t argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        zmk_esb_reset_hist();
+        return 0;
+    }
+
+    shell_print(sh, "%-9s %-6s %10s %8s %8s %8s", "type", "hist", "count", "p50_us", "p99_us",
+                "max_us");
+
+    for (int type = ZMK_ESB_REPORT_KEYBOARD; type <= ZMK_ESB_REPORT_MOUSE; type++) {
+        for (int hist = 0; hist < ZMK_ESB_HIST_COUNT; hist++) {
+            struct zmk_esb_hist_summary summary;
+
+            if (zmk_esb_get_hist(type, hist, &summary) != 0 || summary.count == 0) {
+                continue;
+            }
+
+            shell_print(sh, "%-9s %-6s %10u %8u %8u %8u", esb_shell_types[type - 1],
+                        esb_shell_hists[hist], summary.count, summary.p50_us, summary.p99_us,
+                        summary.max_us);
+        }
+    }
+
+    return 0;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(esb_cmds,
+                               SHELL_CMD(stats, NULL, "Frame, byte, drop and merge counters",
+                                         cmd_esb_stats),
+                               SHELL_CMD(link, NULL, "Link state and channel quality",
+                                         cmd_esb_link),
+                               SHELL_CMD_ARG(rate, NULL, "Report rate [1000|2000|4000|8000]",
+                                             cmd_esb_rate, 1, 1),
+                               SHELL_CMD(baud, NULL, "UART rate", cmd_esb_baud),
+                               SHELL_CMD(reset-stats, NULL, "Clear all counters",
+                                         cmd_esb_reset_stats),
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+                               SHELL_CMD_ARG(hist, NULL,
+                                             "Latency p50/p99/max per report type [reset]",
+                                             cmd_esb_hist, 1, 1),
+#endif
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(esb, &esb_cmds, "ESB transport", NULL);
@@ -0,0 +1,174 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Each sample moves the SOF phase estimate 1/4 of the way to the observed one
+#define ESB_SYNC_EWMA_SHIFT 2
+// Without a sample for this many periods the estimate is considered lost
+#define ESB_SYNC_STALE_PERIODS 4
+
+static bool esb_sync_valid(const struct esb_transport_data *data) {
+    return data->sync.interval > 0 &&
+           k_uptime_get() - data->sync.last_sample <
+               ESB_SYNC_STALE_PERIODS * CONFIG_ZMK_ESB_TIME_SYNC_PERIOD_MS;
+}
+
+// Position of a cycle count within the dongle's poll interval, 0 at SOF
+static uint32_t esb_sync_phase(const struct esb_transport_data *data, uint32_t now) {
+    int32_t phase = (int32_t)(now - data->sync.sof_ref) % (int32_t)data->sync.interval;
+
+    return phase < 0 ? phase + data->sync.interval : phase;
+}
+
+int esb_sync_start(const struct device *dev) {
+    struct esb_ctrl_time_sync msg = {
+        .period_ms = sys_cpu_to_le16(CONFIG_ZMK_ESB_TIME_SYNC_PERIOD_MS),
+    };
+
+    return esb_transport_send_ctrl(dev, ESB_CTRL_TIME_SYNC, &msg, sizeof(msg), K_NO_WAIT);
+}
+
+// Called from the UART ISR as the last byte of the sample arrives
+void esb_sync_handle(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_evt_time_sync *evt = (const void *)payload;
+    uint32_t now = k_cycle_get_32();
+
+    if (len < sizeof(*evt) || evt->interval_us == 0) {
+        return;
+    }
+
+    uint32_t interval = k_us_to_cyc_ceil32(sys_le16_to_cpu(evt->interval_us));
+    uint32_t sof = now - k_us_to_cyc_ceil32(sys_le16_to_cpu(evt->sof_age_us));
+
+    k_spinlock_key_t key = k_spin_lock(&data->sync.lock);
+
+    if (!esb_sync_valid(data) || interval != data->sync.interval) {
+        data->sync.sof_ref = sof;
+        data->sync.interval = interval;
+        data->sync.jitter = 0;
+    } else {
+        // Snap to the nearest predicted SOF and correct toward the sample
+        uint32_t phase = esb_sync_phase(data, sof);
+        int32_t err = phase < interval / 2 ? (int32_t)phase : (int32_t)phase - (int32_t)interval;
+        uint32_t predicted = sof - err;
+        uint32_t abs_err = err < 0 ? -err : err;
+
+        data->sync.sof_ref = predicted + err / (1 << ESB_SYNC_EWMA_SHIFT);
+        data->sync.jitter += ((int32_t)abs_err - (int32_t)data->sync.jitter) /
+                             (1 << ESB_SYNC_EWMA_SHIFT);
+    }
+
+    data->sync.last_sample = k_uptime_get();
+
+    k_spin_unlock(&data->sync.lock, key);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_POLL_ALIGN)
+static void esb_sync_release_work(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct esb_transport_data *data =
+        CONTAINER_OF(dwork, struct esb_transport_data, sync.release_work);
+
+    esb_hid_release(data->dev);
+}
+
+// Cycles until frames should leave to be the freshest report at the next poll
+static uint32_t esb_sync_until_release(const struct esb_transport_data *data, uint32_t now) {
+    uint32_t interval = data->sync.interval;
+    uint32_t lead = k_us_to_cyc_ceil32(CONFIG_ZMK_ESB_POLL_ALIGN_LEAD_US) % interval;
+    uint32_t to_sof = interval - esb_sync_phase(data, now);
+
+    return (to_sof + interval - lead) % interval;
+}
+
+// Called with the HID queue locked. Holds frames until the release point of the
+// next poll and arms the release; frames go out at once without a valid estimate.
+bool esb_sync_hold(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    if (!data->sync.align) {
+        return false;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->sync.lock);
+    bool valid = esb_sync_valid(data);
+    uint32_t delay = valid ? esb_sync_until_release(data, k_cycle_get_32()) : 0;
+    k_spin_unlock(&data->sync.lock, key);
+
+    // Closer than one tick to the release point is as good as on it
+    if (delay <= k_ticks_to_cyc_ceil32(1)) {
+        return false;
+    }
+
+    if (!k_work_delayable_is_pending(&data->sync.release_work)) {
+        k_work_schedule(&data->sync.release_work, K_TICKS(k_cyc_to_ticks_ceil32(delay)));
+    }
+
+    return true;
+}
+#endif
+
+void esb_sync_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    data->sync.interval = 0;
+#if IS_ENABLED(CONFIG_ZMK_ESB_POLL_ALIGN)
+    data->sync.align = true;
+    k_work_init_delayable(&data->sync.release_work, esb_sync_release_work);
+#endif
+}
+
+int zmk_esb_get_time_sync(struct zmk_esb_time_sync *sync) {
+    struct esb_transport_data *data = esb_transport_default()->data;
+
+    if (sync == NULL) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->sync.lock);
+
+    sync->synced = esb_sync_valid(data);
+    if (sync->synced) {
+        sync->interval_us = k_cyc_to_us_near32(data->sync.interval);
+        sync->jitter_us = k_cyc_to_us_near32(data->sync.jitter);
+        sync->next_poll_us = k_cyc_to_us_near32(
+            data->sync.interval - esb_sync_phase(data, k_cycle_get_32()));
+    } else {
+        sync->interval_us = 0;
+        sync->jitter_us = 0;
+        sync->next_poll_us = 0;
+    }
+
+    k_spin_unlock(&data->sync.lock, key);
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_POLL_ALIGN)
+void zmk_esb_set_poll_align(bool enable) {
+    const struct device *dev;
+
+    for (int i = 0; (dev = esb_transport_get(i)) != NULL; i++) {
+        struct esb_transport_data *data = dev->data;
+
+        data->sync.align = enable;
+        if (!enable && k_work_delayable_is_pending(&data->sync.release_work)) {
+            k_work_reschedule(&data->sync.release_work, K_NO_WAIT);
+        }
+    }
+}
+
+bool zmk_esb_get_poll_align(void) {
+    const struct esb_transport_data *data = esb_transport_default()->data;
+
+    return data->sync.align;
+}
+#endif
@@ -0,0 +1,119 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk_feature_esb_transport/esb.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Each sample moves a stage average 1/8 of the way
+#define ESB_TIMING_EWMA_SHIFT 3
+
+static uint16_t esb_timing_us(uint32_t cycles) {
+    return MIN(k_cyc_to_us_near32(cycles), UINT16_MAX);
+}
+
+// Called with the HID queue locked as a frame leaves it alone. Every
+// CONFIG_ZMK_ESB_TIMING_SAMPLE_EVERY frames, one travels to BLESB wrapped with
+// its stamp and time spent queued. Returns the wrapped length, or 0 to send the
+// frame as it is.
+size_t esb_timing_pack(const struct device *dev, const struct esb_frame *frame, uint8_t *out) {
+    struct esb_transport_data *data = dev->data;
+    struct hid_packet_header *header = (struct hid_packet_header *)out;
+    struct esb_timed_header *timed = (struct esb_timed_header *)&out[sizeof(*header)];
+    size_t report_len = frame->len - sizeof(struct hid_packet_header);
+    size_t len = sizeof(*header) + sizeof(*timed) + report_len;
+    uint8_t type = frame->data[0];
+
+    if (!(data->caps & ESB_CAPS_TIMING) || type < HID_PACKET_TYPE_KEYBOARD ||
+        type > HID_PACKET_TYPE_MOUSE || len > data->max_payload ||
+        ++data->timing.countdown < CONFIG_ZMK_ESB_TIMING_SAMPLE_EVERY) {
+        return 0;
+    }
+
+    data->timing.countdown = 0;
+
+    header->type = ESB_FRAME_TIMED;
+    header->length = len - sizeof(*header);
+    timed->stamp = sys_cpu_to_le32(frame->stamp);
+    timed->queue_us = sys_cpu_to_le16(esb_timing_us(k_cycle_get_32() - frame->stamp));
+    timed->type = type;
+    memcpy(&out[sizeof(*header) + sizeof(*timed)], &frame->data[sizeof(struct hid_packet_header)],
+           report_len);
+
+    return len;
+}
+
+// Called from the UART ISR as the last byte of the echo arrives. The UART stage
+// is what remains of the round trip on our clock once the queueing, the time
+// BLESB held the echo and the echo's own wire time are taken out.
+void esb_timing_handle(const struct device *dev, const uint8_t *payload, uint8_t len) {
+    struct esb_transport_data *data = dev->data;
+    const struct esb_evt_timing *evt = (const void *)payload;
+    uint32_t now = k_cycle_get_32();
+    uint32_t baud;
+
+    if (len < sizeof(*evt) || esb_transport_get_baud(dev, &baud) != 0 || baud == 0) {
+        return;
+    }
+
+    uint32_t total_us = k_cyc_to_us_near32(now - sys_le32_to_cpu(evt->stamp));
+    // 10 bits per byte on the wire: start, 8 data, stop
+    uint32_t wire_us = (sizeof(struct hid_packet_header) + len) * 10U * USEC_PER_SEC / baud;
+    int32_t uart_us = (int32_t)total_us - sys_le16_to_cpu(evt->queue_us) -
+                      sys_le16_to_cpu(evt->held_us) - (int32_t)wire_us;
+    uint16_t sample[ZMK_ESB_STAGE_COUNT] = {
+        [ZMK_ESB_STAGE_QUEUE] = sys_le16_to_cpu(evt->queue_us),
+        [ZMK_ESB_STAGE_UART] = CLAMP(uart_us, 0, UINT16_MAX),
+        [ZMK_ESB_STAGE_RADIO] = sys_le16_to_cpu(evt->radio_us),
+        [ZMK_ESB_STAGE_USB] = sys_le16_to_cpu(evt->usb_us),
+    };
+
+    k_spinlock_key_t key = k_spin_lock(&data->timing.lock);
+
+    for (int stage = 0; stage < ZMK_ESB_STAGE_COUNT; stage++) {
+        data->timing.last[stage] = sample[stage];
+        data->timing.max[stage] = MAX(data->timing.max[stage], sample[stage]);
+        if (data->timing.samples == 0) {
+            data->timing.avg[stage] = sample[stage];
+        } else {
+            data->timing.avg[stage] += ((int32_t)sample[stage] - (int32_t)data->timing.avg[stage]) /
+                                       (1 << ESB_TIMING_EWMA_SHIFT);
+        }
+    }
+    data->timing.samples++;
+
+    k_spin_unlock(&data->timing.lock, key);
+}
+
+void esb_timing_init(const struct device *dev) {
+    struct esb_transport_data *data = dev->data;
+
+    data->timing.countdown = 0;
+    data->timing.samples = 0;
+    memset(data->timing.max, 0, sizeof(data->timing.max));
+}
+
+int zmk_esb_get_timing(struct zmk_esb_timing *timing) {
+    struct esb_transport_data *data = esb_transport_default()->data;
+
+    if (timing == NULL) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&data->timing.lock);
+
+    timing->samples = data->timing.samples;
+    for (int stage = 0; stage < ZMK_ESB_STAGE_COUNT; stage++) {
+        timing->stages[stage].last_us = data->timing.last[stage];
+        timing->stages[stage].avg_us = data->timing.avg[stage];
+        timing->stages[stage].max_us = data->timing.max[stage];
+    }
+
+    k_spin_unlock(&data->timing.lock, key);
+    return 0;
+}
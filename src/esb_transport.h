@@ -0,0 +1,579 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/ring_buffer.h>
+#if IS_ENABLED(CONFIG_SETTINGS)
+#include <zephyr/settings/settings.h>
+#endif
+
+#include <zmk/hid.h>
+#include <zmk_feature_esb_transport/esb.h>
+#include <zmk_feature_esb_transport/esb_hid.h>
+
+#include "esb_protocol.h"
+
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+#define ESB_HID_REPORT_MAX                                                                         \
+    MAX(MAX(sizeof(struct zmk_hid_keyboard_report_body), sizeof(struct zmk_hid_consumer_report)), \
+        sizeof(struct zmk_hid_mouse_report))
+#else
+#define ESB_HID_REPORT_MAX                                                                         \
+    MAX(sizeof(struct zmk_hid_keyboard_report_body), sizeof(struct zmk_hid_consumer_report))
+#endif
+
+// TX priority lanes, highest first. Bulk shares the mouse lane.
+enum esb_lane {
+    ESB_LANE_KEYBOARD,
+    ESB_LANE_CONSUMER,
+    ESB_LANE_MOUSE,
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+    ESB_LANE_RESYNC,              // Idle state snapshots, never given a turn early
+#endif
+    ESB_LANE_COUNT,
+};
+
+#define ESB_FRAME_NONE 0xFF
+
+// Log2 latency buckets, the last one open-ended at 2^14 us
+#define ESB_HIST_BUCKETS 16
+
+// Room for the sequence header of a redundantly sent keyboard report
+#if IS_ENABLED(CONFIG_ZMK_ESB_REDUNDANT_KEYS)
+#define ESB_FRAME_WRAP_MAX sizeof(struct esb_seq_header)
+#else
+#define ESB_FRAME_WRAP_MAX 0
+#endif
+
+// One queued HID frame, header included
+struct esb_frame {
+    uint8_t len;
+    uint8_t next;                 // Next frame slot in the same lane or free list
+    uint32_t stamp;               // Cycle count as the report entered the transport
+    uint8_t data[sizeof(struct hid_packet_header) + ESB_FRAME_WRAP_MAX + ESB_HID_REPORT_MAX];
+};
+
+// One paired dongle, as persisted in settings
+struct esb_profile {
+    struct zmk_esb_address address;
+    uint8_t channel;              // Last-known RF channel
+};
+
+// Per-instance configuration, taken from the zmk,esb-transport devicetree node
+struct esb_transport_config {
+    uint8_t index;                // Devicetree instance number
+    const struct device *uart;
+    uint32_t baud_target;         // 0 keeps the rate configured on the UART node
+    uint32_t dfu_baud;            // Rate to propose for firmware updates, 0 to keep
+    uint16_t max_payload;         // Upper bound for the negotiated ESB payload
+    uint8_t *tx_queue;
+    uint16_t tx_queue_size;
+    struct esb_frame *frames;
+    uint8_t frame_queue_depth;
+    uint8_t *batch_buf;           // max_payload bytes
+    uint8_t *rx_buf;
+    uint16_t rx_buf_size;
+    const uint8_t *rf_channels;   // Initial RF channel list
+    uint8_t rf_channel_count;
+    bool has_mode_detect;
+    struct gpio_dt_spec rts_gpio;
+    struct gpio_dt_spec cts_gpio;
+    bool has_wake;
+    struct gpio_dt_spec wake_gpio;  // Pulsed to wake BLESB
+    bool has_host_wake;
+    struct gpio_dt_spec host_wake_gpio;  // Asserted by BLESB before it sends
+};
+
+// Per-instance runtime state
+struct esb_transport_data {
+    const struct device *dev;
+    bool connected;
+    bool selected;                // ZMK endpoint was ESB at the last endpoint change
+
+    // UART TX: whole frames are queued here and drained by the UART ISR
+    struct ring_buf tx_ring;
+    struct k_spinlock tx_lock;
+    struct k_sem tx_space;
+
+    // Transport counters, see zmk_esb_get_stats()
+    struct {
+        atomic_t frames;          // HID frames handed to the UART
+        atomic_t tx_bytes;
+        atomic_t rx_bytes;
+        atomic_t dropped;         // HID frames discarded unsent
+        atomic_t refused;         // Reports refused with -EAGAIN
+        atomic_t retransmits;     // ESB retransmits reported by BLESB
+    } stats;
+
+    // UART RX: assembly of one BLESB protocol message
+    size_t rx_pos;
+    bool rx_frame;                // Binary frame rather than a text line
+
+    struct k_work_delayable reboot_work;
+
+    // Negotiated with BLESB through the capability exchange
+    uint8_t max_payload;          // Largest frame per ESB payload, header included
+    uint8_t caps;                 // ESB_CAPS_* flags
+
+    // HID frame queue, drained into tx_ring by esb_hid_flush()
+    struct {
+        struct k_spinlock lock;
+        struct k_sem space;
+        struct k_work flush_work;
+        atomic_t blocked;         // BIT(type) of reports refused with -EAGAIN
+        struct k_work space_work; // Raises zmk_esb_tx_space_available
+        uint8_t count;            // Frames queued over all lanes
+        uint8_t free;             // First unused frame slot
+        struct {
+            uint8_t head;         // Frame slots, ESB_FRAME_NONE when empty
+            uint8_t tail;
+            uint8_t passed;       // Frames sent from higher lanes meanwhile
+        } lanes[ESB_LANE_COUNT];
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+        uint8_t bulk_passed;      // HID payloads sent while bulk waited
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+        uint32_t live;            // Reports queued outside the resync lane
+#endif
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+        // Last report queued per type, indexed by type - 1
+        uint8_t last[ZMK_ESB_REPORT_TYPE_COUNT][ESB_HID_REPORT_MAX];
+        uint8_t last_len[ZMK_ESB_REPORT_TYPE_COUNT];  // 0 forces the next report out
+        uint32_t last_time[ZMK_ESB_REPORT_TYPE_COUNT];
+        atomic_t suppressed;
+#endif
+        uint8_t frag_lane;        // Lane whose head is being sent in fragments
+        uint8_t frag_msg_id;
+        uint8_t frag_index;
+#if IS_ENABLED(CONFIG_ZMK_HID_INDICATORS)
+        atomic_t leds;            // Latest host LED state from the dongle
+        struct k_work output_work;
+#endif
+    } hid;
+
+    // Fragmentation and reassembly, see esb_frag.c
+    struct {
+        atomic_t tx_msg_id;
+        uint8_t rx_buf[CONFIG_ZMK_ESB_REASSEMBLY_SIZE];
+        size_t rx_len;
+        uint8_t rx_msg_id;
+        uint8_t rx_count;
+        uint8_t rx_next;
+        bool rx_active;
+        bool rx_ready;            // Complete message waiting for rx_work
+        struct k_work_delayable timeout_work;
+        struct k_work rx_work;
+    } frag;
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_BULK)
+    // Sliding-window bulk channel, see esb_bulk.c. Offsets count bytes since
+    // init and index tx_buf modulo its size.
+    struct {
+        struct k_spinlock lock;
+        uint8_t tx_buf[CONFIG_ZMK_ESB_BULK_TX_BUF_SIZE];
+        uint32_t tail;            // Oldest unacknowledged byte
+        uint32_t sent;            // Next byte to send
+        uint32_t head;            // End of written data
+        uint16_t base_seq;        // Oldest unacknowledged segment
+        uint16_t next_seq;
+        uint32_t seg_end[CONFIG_ZMK_ESB_BULK_WINDOW];
+        struct k_sem tx_space;
+        struct k_work_delayable retransmit_work;
+        int64_t busy_since;
+
+        uint8_t rx_buf[CONFIG_ZMK_ESB_BULK_RX_BUF_SIZE];
+        struct ring_buf rx_ring;
+        uint16_t rx_next;
+        struct k_work rx_work;
+
+        struct {
+            uint32_t tx_bytes;    // Acknowledged
+            uint32_t rx_bytes;
+            uint32_t retransmits;
+            uint32_t busy_ms;     // Time with unacknowledged data
+        } stats;
+    } bulk;
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+    // BLESB firmware update, see esb_dfu.c. Written by the UART ISR, consumed
+    // by the thread running the update.
+    struct {
+        struct k_spinlock lock;
+        struct k_sem status;      // Given for each BLESB answer
+        atomic_t active;
+        uint32_t size;
+        uint32_t acked;           // Next byte BLESB expects
+        uint8_t last_status;
+        bool resend;
+        uint32_t baudrate;        // Rate BLESB accepted, 0 to stay
+    } dfu;
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIMING)
+    // Per-stage latency from timed frames, see esb_timing.c
+    struct {
+        struct k_spinlock lock;
+        uint8_t countdown;        // Frames sent alone since the last timed one
+        uint32_t samples;
+        uint16_t last[ZMK_ESB_STAGE_COUNT];
+        uint16_t avg[ZMK_ESB_STAGE_COUNT];
+        uint16_t max[ZMK_ESB_STAGE_COUNT];
+    } timing;
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+    // Latency histograms per report type, indexed by type - 1, see esb_hist.c
+    struct {
+        atomic_t buckets[ZMK_ESB_REPORT_TYPE_COUNT][ZMK_ESB_HIST_COUNT][ESB_HIST_BUCKETS];
+        atomic_t max[ZMK_ESB_REPORT_TYPE_COUNT][ZMK_ESB_HIST_COUNT];  // us
+        atomic_t wire_left;       // Bytes up to the end of the timed payload, 0 when none
+        uint32_t wire_stamp;
+        uint8_t wire_type;
+    } hist;
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_TIME_SYNC)
+    // Dongle USB poll phase on our cycle counter, see esb_sync.c
+    struct {
+        struct k_spinlock lock;
+        uint32_t sof_ref;         // Cycle count of a recent dongle SOF
+        uint32_t interval;        // Poll interval in cycles, 0 until synced
+        uint32_t jitter;          // Smoothed phase error in cycles
+        int64_t last_sample;
+#if IS_ENABLED(CONFIG_ZMK_ESB_POLL_ALIGN)
+        bool align;               // Release frames just ahead of the poll
+        struct k_work_delayable release_work;
+#endif
+    } sync;
+#endif
+
+    // Report rate profile and mouse merge window, see esb_rate.c
+    struct {
+        uint32_t gap;             // Report interval in cycles
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+        struct k_spinlock lock;
+        struct zmk_hid_mouse_report mouse;
+        bool mouse_pending;       // Motion merged while the window is closed
+        uint32_t mouse_stamp;     // Entry time of the oldest motion merged
+        uint32_t mouse_last;      // Cycle count of the last mouse frame
+        atomic_t merged;          // Mouse reports merged into another
+        atomic_t expired;         // Mouse frames past CONFIG_ZMK_ESB_MOUSE_DEADLINE_US
+        struct k_work_delayable mouse_work;
+#endif
+    } rate;
+
+    // Latency mode and link sleep, see esb_power.c
+    struct {
+        struct k_spinlock lock;
+        bool enabled;             // Set once BLESB is reachable in ESB mode
+        uint8_t state;            // enum esb_power_state
+        bool waking;              // Frames held until wake_ready
+        bool measuring;           // Waiting for the first report after a wake
+        uint32_t wake_start;
+        uint32_t wake_ready;
+        struct k_work_delayable idle_work;
+        struct k_work_delayable wake_work;
+        struct {
+            uint32_t wakes;
+            uint32_t last_us;     // Wake to first report
+            uint32_t max_us;
+        } stats;
+
+        // UART runtime PM references
+        struct k_mutex pm_lock;
+        bool link_ref;            // Held while BLESB may send unannounced
+        bool rx_ref;              // Held while BLESB asserts host-wake
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+        bool dfu_ref;             // Held for the whole of a firmware update
+#endif
+        bool pinned;              // Resume over budget, UART never released
+        bool resuming;            // Waiting for the first byte after a resume
+        bool tx_ref;              // Held until queued TX has drained, under tx_lock
+        bool tx_used;             // Bytes queued since tx_ref was last taken
+        uint32_t resume_start;
+        struct k_work host_wake_work;
+        struct gpio_callback host_wake_cb;
+        struct {
+            uint32_t count;
+            uint32_t last_us;     // Resume to first byte in the UART FIFO
+            uint32_t max_us;
+        } resume;
+    } power;
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_RATE_LIMIT)
+    // Token buckets per report type, indexed by type - 1, see esb_limit.c
+    struct {
+        struct k_spinlock lock;
+        uint32_t tokens[ZMK_ESB_REPORT_TYPE_COUNT];   // Milli-tokens
+        uint32_t last_refill;                         // Uptime in ms
+        atomic_t limited[ZMK_ESB_REPORT_TYPE_COUNT];  // Reports held back for a token
+        struct zmk_hid_consumer_report consumer;      // Latest state held back
+        uint32_t consumer_stamp;
+        bool consumer_pending;
+        struct k_work_delayable work;                 // Runs once the next token is in
+    } limit;
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_ESB_REDUNDANT_KEYS)
+    // Keyboard state changes sent twice, see esb_redundant.c
+    struct {
+        struct k_spinlock lock;
+        uint8_t seq;
+        uint8_t last[sizeof(struct zmk_hid_keyboard_report_body)];
+        uint8_t copy[sizeof(struct esb_seq_header) + sizeof(struct zmk_hid_keyboard_report_body)];
+        uint8_t copy_len;         // Second copy still to send, 0 if none
+        struct k_work_delayable copy_work;
+    } redundant;
+#endif
+
+    // Pipe routing per report type, indexed by type - 1
+    struct zmk_esb_pipe_config pipes[ZMK_ESB_REPORT_TYPE_COUNT];
+
+    // RF channel list and per-channel failure rate, see esb_channel.c
+    struct {
+        struct k_spinlock lock;
+        uint8_t list[ZMK_ESB_CHANNELS_MAX];
+        uint16_t fail_permille[ZMK_ESB_CHANNELS_MAX];
+        uint8_t count;
+        uint8_t active;           // Index into list
+        int64_t last_hop;
+    } channels;
+
+    // Paired dongles, see esb_profile.c
+    struct {
+        struct esb_profile list[CONFIG_ZMK_ESB_PROFILE_COUNT];
+        uint8_t active;
+#if IS_ENABLED(CONFIG_SETTINGS)
+        struct k_work_delayable save_work;
+#endif
+    } profiles;
+};
+
+/**
+ * @brief Look up an instance by devicetree instance number
+ *
+ * @return The instance, or NULL past the last one
+ */
+const struct device *esb_transport_get(int index);
+
+/**
+ * @brief Instance carrying keyboard and consumer reports
+ */
+const struct device *esb_transport_default(void);
+
+/**
+ * @brief Instance carrying mouse reports, the default instance unless a
+ * zmk,esb-pointing-transport chosen node is set
+ */
+const struct device *esb_transport_pointing(void);
+
+/**
+ * @brief Instance carrying a given report type
+ */
+const struct device *esb_transport_for_report(enum zmk_esb_report_type type);
+
+/**
+ * @brief Check whether BLESB behind an instance has confirmed ESB mode
+ */
+bool esb_transport_is_connected(const struct device *dev);
+
+/**
+ * @brief Update the connection state, raising the event and re-syncing BLESB
+ * when it changes
+ */
+void esb_transport_set_connected(const struct device *dev, bool connected);
+
+/**
+ * @brief Ask BLESB to confirm ESB mode, which reconnects the instance
+ */
+void esb_transport_probe(const struct device *dev);
+
+/**
+ * @brief Read or change the UART rate to BLESB
+ *
+ * @return 0 on success, -ENOTSUP without CONFIG_UART_USE_RUNTIME_CONFIGURE
+ */
+int esb_transport_get_baud(const struct device *dev, uint32_t *baudrate);
+int esb_transport_set_baud(const struct device *dev, uint32_t baudrate);
+
+/**
+ * @brief Queue bytes for transmission to BLESB
+ *
+ * The buffer is queued whole or not at all, so frames are never interleaved.
+ *
+ * @param timeout How long to wait for queue space; use K_NO_WAIT from ISRs
+ * @return 0 on success, -EMSGSIZE if the buffer can never fit the queue,
+ *         -EAGAIN if no space became available within the timeout
+ */
+int esb_transport_tx(const struct device *dev, const uint8_t *buf, size_t len,
+                     k_timeout_t timeout);
+
+/**
+ * @brief Dispatch one complete binary frame received from BLESB
+ */
+void esb_transport_handle_frame(const struct device *dev, uint8_t type, const uint8_t *payload,
+                                uint8_t len);
+
+/**
+ * @brief Number of bytes queued for the UART but not yet sent
+ */
+size_t esb_transport_tx_pending(const struct device *dev);
+
+/**
+ * @brief Queue one binary control frame for BLESB
+ *
+ * @param type ESB_CTRL_* message type
+ */
+int esb_transport_send_ctrl(const struct device *dev, uint8_t type, const void *payload,
+                            size_t len, k_timeout_t timeout);
+
+// HID frame queue (esb_hid.c)
+void esb_hid_queue_init(const struct device *dev);
+int esb_hid_enqueue(const struct device *dev, uint8_t type, const uint8_t *report, size_t len,
+                    uint32_t stamp, k_timeout_t timeout);
+#if IS_ENABLED(CONFIG_ZMK_ESB_RESYNC)
+uint32_t esb_hid_live(const struct device *dev);
+int esb_hid_enqueue_resync(const struct device *dev, uint8_t type, const uint8_t *report,
+                           size_t len, uint32_t stamp, uint32_t live);
+#endif
+void esb_hid_flush(const struct device *dev);
+void esb_hid_release(const struct device *dev);
+void esb_hid_tx_ready(const struct device *dev);
+bool esb_hid_pending(const struct device *dev);
+void esb_hid_notify_space(const struct device *dev);
+void esb_hid_preempt(const struct device *dev, const struct esb_frame *frames, size_t count);
+#if IS_ENABLED(CONFIG_ZMK_ESB_SUPPRESS_DUPLICATES)
+void esb_hid_forget(const struct device *dev);
+#else
+static inline void esb_hid_forget(const struct device *dev) {}
+#endif
+void esb_hid_handle_output(const struct device *dev, const uint8_t *payload, uint8_t len);
+
+// Fragmentation (esb_frag.c)
+void esb_frag_init(const struct device *dev);
+uint8_t esb_frag_next_id(const struct device *dev);
+int esb_frag_count(const struct device *dev, size_t payload_len);
+int esb_frag_build(const struct device *dev, uint8_t *out, uint8_t msg_id, uint8_t index,
+                   uint8_t type, const uint8_t *payload, size_t payload_len);
+int esb_frag_send(const struct device *dev, uint8_t type, const uint8_t *payload, size_t len);
+void esb_frag_handle(const struct device *dev, const uint8_t *payload, uint8_t len);
+
+// Bulk channel (esb_bulk.c)
+void esb_bulk_init(const struct device *dev);
+void esb_bulk_reset(const struct device *dev);
+bool esb_bulk_pending(const struct device *dev);
+bool esb_bulk_busy(const struct device *dev);
+size_t esb_bulk_pack(const struct device *dev, uint8_t *out);
+void esb_bulk_handle(const struct device *dev, uint8_t type, const uint8_t *payload, uint8_t len);
+
+// Report rate profiles (esb_rate.c)
+void esb_rate_init(const struct device *dev);
+int esb_rate_sync(const struct device *dev);
+#if IS_ENABLED(CONFIG_ZMK_POINTING)
+int esb_rate_mouse_defer(const struct device *dev, const struct zmk_hid_mouse_report *report,
+                         uint32_t stamp);
+void esb_rate_mouse_merge(struct zmk_hid_mouse_report *acc,
+                          const struct zmk_hid_mouse_report *report);
+void esb_rate_mouse_reset(const struct device *dev);
+#endif
+#if IS_ENABLED(CONFIG_SETTINGS)
+int esb_rate_settings_set(size_t len, settings_read_cb read_cb, void *cb_arg);
+void esb_rate_settings_commit(void);
+#endif
+
+// Latency modes and link sleep (esb_power.c)
+void esb_power_init(const struct device *dev);
+int esb_power_sync(const struct device *dev);
+void esb_power_activity(const struct device *dev, bool report);
+bool esb_power_hold(const struct device *dev);
+void esb_power_note_tx(const struct device *dev);
+void esb_power_tx_get(const struct device *dev);
+bool esb_power_is_awake(const struct device *dev);
+void esb_power_tx_idle(const struct device *dev);
+void esb_power_note_resume_tx(const struct device *dev);
+#if IS_ENABLED(CONFIG_ZMK_ESB_DFU)
+void esb_power_dfu_hold(const struct device *dev, bool hold);
+#endif
+#if IS_ENABLED(CONFIG_SETTINGS)
+int esb_power_settings_set(size_t len, settings_read_cb read_cb, void *cb_arg);
+void esb_power_settings_commit(void);
+#endif
+
+// Pipe routing (esb_pipe.c)
+void esb_pipe_init(const struct device *dev);
+int esb_pipe_sync(const struct device *dev);
+
+// RF channel agility (esb_channel.c)
+#define ESB_CHANNELS_DEFAULT {4, 25, 42, 63, 77}
+
+void esb_channel_init(const struct device *dev);
+int esb_channel_sync(const struct device *dev);
+void esb_channel_handle_stats(const struct device *dev, const uint8_t *payload, uint8_t len);
+void esb_channel_handle_active(const struct device *dev, const uint8_t *payload, uint8_t len);
+void esb_channel_set_active(const struct device *dev, uint8_t channel);
+
+// Dongle profiles (esb_profile.c)
+void esb_profile_init(const struct device *dev);
+int esb_profile_sync(const struct device *dev);
+void esb_profile_note_channel(const struct device *dev, uint8_t channel);
+void esb_profile_handle_paired(const struct device *dev, const uint8_t *payload, uint8_t len);
+
+// BLESB firmware update (esb_dfu.c)
+void esb_dfu_init(const struct device *dev);
+void esb_dfu_handle_baud(const struct device *dev, const uint8_t *payload, uint8_t len);
+void esb_dfu_handle_status(const struct device *dev, const uint8_t *payload, uint8_t len);
+
+// Per-type rate limits (esb_limit.c)
+void esb_limit_init(const struct device *dev);
+bool esb_limit_take(const struct device *dev, uint8_t type);
+bool esb_limit_defer_consumer(const struct device *dev, const uint8_t *report, size_t len,
+                              uint32_t stamp);
+void esb_limit_reset(const struct device *dev);
+void esb_limit_get_stats(struct zmk_esb_hid_stats *stats);
+
+// Per-stage latency (esb_timing.c)
+void esb_timing_init(const struct device *dev);
+size_t esb_timing_pack(const struct device *dev, const struct esb_frame *frame, uint8_t *out);
+void esb_timing_handle(const struct device *dev, const uint8_t *payload, uint8_t len);
+
+// Latency histograms (esb_hist.c)
+#if IS_ENABLED(CONFIG_ZMK_ESB_HISTOGRAMS)
+void esb_hist_init(const struct device *dev);
+uint8_t esb_hist_frame_type(const uint8_t *buf);
+void esb_hist_record(const struct device *dev, uint8_t type, enum zmk_esb_hist hist,
+                     uint32_t cycles);
+void esb_hist_note_payload(const struct device *dev, const uint8_t *buf);
+void esb_hist_note_wire(const struct device *dev, size_t sent);
+#endif
+
+// Replay across radio dropouts (esb_replay.c)
+void esb_replay_handle_link(const struct device *dev, const uint8_t *payload, uint8_t len);
+bool esb_replay_hold(const struct device *dev);
+void esb_replay_reset(const struct device *dev);
+
+// Redundant keyboard frames (esb_redundant.c)
+void esb_redundant_init(const struct device *dev);
+int esb_redundant_send(const struct device *dev, const uint8_t *report, size_t len,
+                       uint32_t stamp);
+void esb_redundant_reset(const struct device *dev);
+
+// Release-all on link loss (esb_release.c)
+void esb_release_all(const struct device *dev);
+int esb_release_sync(const struct device *dev);
+void esb_release_note_report(void);
+
+// Idle state resync (esb_resync.c)
+void esb_resync_start(const struct device *dev);
+void esb_resync_note_report(void);
+
+// Dongle clock sync (esb_sync.c)
+void esb_sync_init(const struct device *dev);
+int esb_sync_start(const struct device *dev);
+void esb_sync_handle(const struct device *dev, const uint8_t *payload, uint8_t len);
+#if IS_ENABLED(CONFIG_ZMK_ESB_POLL_ALIGN)
+bool esb_sync_hold(const struct device *dev);
+#else
+static inline bool esb_sync_hold(const struct device *dev) { return false; }
+#endif
@@ -0,0 +1,4 @@
+#include <zmk_feature_esb_transport/events/esb_tx_space_available.h>
+
+// ESB TX space available event implementation
+ZMK_EVENT_IMPL(zmk_esb_tx_space_available);
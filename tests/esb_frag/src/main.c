@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2025 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/ztest.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+static struct esb_transport_data fake_data;
+static const struct device fake_dev = {
+    .name = "esb_fake",
+    .data = &fake_data,
+};
+
+static size_t fake_tx_frames;
+static uint8_t fake_handled_type;
+static size_t fake_handled;
+
+// Fakes of the transport functions esb_frag.c calls
+
+const struct device *esb_transport_default(void) { return &fake_dev; }
+
+bool esb_transport_is_connected(const struct device *dev) { return true; }
+
+int esb_transport_tx(const struct device *dev, const uint8_t *buf, size_t len,
+                     k_timeout_t timeout) {
+    fake_tx_frames++;
+    return 0;
+}
+
+size_t esb_transport_tx_pending(const struct device *dev) { return 0; }
+
+int esb_transport_send_ctrl(const struct device *dev, uint8_t type, const void *payload,
+                            size_t len, k_timeout_t timeout) {
+    fake_tx_frames++;
+    return 0;
+}
+
+void esb_transport_handle_frame(const struct device *dev, uint8_t type, const uint8_t *payload,
+                                uint8_t len) {
+    fake_handled_type = type;
+    fake_handled++;
+}
+
+void esb_power_activity(const struct device *dev, bool report) {}
+
+// Negotiated payload as a caps reply of that size would have left it
+static void esb_frag_test_caps(uint8_t max_payload) {
+    fake_data.max_payload = max_payload;
+    fake_data.caps = ESB_CAPS_FRAGMENT;
+}
+
+static void esb_frag_test_before(void *fixture) {
+    memset(&fake_data, 0, sizeof(fake_data));
+    fake_data.dev = &fake_dev;
+    esb_frag_init(&fake_dev);
+    fake_tx_frames = 0;
+    fake_handled = 0;
+    fake_handled_type = 0;
+}
+
+ZTEST(esb_frag, test_count_and_build) {
+    uint8_t payload[60] = {0};
+    uint8_t out[ESB_PAYLOAD_LEGACY];
+
+    esb_frag_test_caps(ESB_PAYLOAD_LEGACY);
+
+    // 27 bytes of the message [type][payload...] per fragment
+    zassert_equal(esb_frag_count(&fake_dev, sizeof(payload)), 3);
+    zassert_equal(esb_frag_build(&fake_dev, out, 0, 0, ZMK_ESB_MESSAGE_VENDOR, payload,
+                                 sizeof(payload)),
+                  ESB_PAYLOAD_LEGACY);
+    zassert_equal(esb_frag_build(&fake_dev, out, 0, 2, ZMK_ESB_MESSAGE_VENDOR, payload,
+                                 sizeof(payload)),
+                  5 + 61 - 2 * 27);
+    zassert_equal(esb_frag_build(&fake_dev, out, 0, 3, ZMK_ESB_MESSAGE_VENDOR, payload,
+                                 sizeof(payload)),
+                  -EINVAL);
+}
+
+ZTEST(esb_frag, test_payload_too_small) {
+    uint8_t payload[60] = {0};
+    uint8_t out[ESB_PAYLOAD_LEGACY];
+
+    for (uint8_t max_payload = 0; max_payload <= 5; max_payload++) {
+        esb_frag_test_caps(max_payload);
+
+        zassert_equal(esb_frag_count(&fake_dev, sizeof(payload)), -EINVAL,
+                      "count with %d byte payloads", max_payload);
+        zassert_equal(esb_frag_build(&fake_dev, out, 0, 0, ZMK_ESB_MESSAGE_VENDOR, payload,
+                                     sizeof(payload)),
+                      -EINVAL, "build with %d byte payloads", max_payload);
+        zassert_equal(esb_frag_send(&fake_dev, ZMK_ESB_MESSAGE_VENDOR, payload, sizeof(payload)),
+                      -EINVAL, "send with %d byte payloads", max_payload);
+    }
+
+    zassert_equal(fake_tx_frames, 0);
+}
+
+ZTEST(esb_frag, test_reassembled_frame) {
+    // [msg_id][index][count] then the message [type][payload...]
+    const uint8_t first[] = {7, 0, 2, ESB_EVT_CHANNEL_ACTIVE};
+    const uint8_t second[] = {7, 1, 2, 40};
+
+    esb_frag_handle(&fake_dev, first, sizeof(first));
+    zassert_equal(fake_handled, 0);
+    esb_frag_handle(&fake_dev, second, sizeof(second));
+    zassert_equal(fake_handled, 1);
+    zassert_equal(fake_handled_type, ESB_EVT_CHANNEL_ACTIVE);
+    zassert_equal(fake_data.frag.rx_len, 0);
+}
+
+ZTEST(esb_frag, test_nested_frames_dropped) {
+    const uint8_t nested[] = {ESB_FRAME_FRAGMENT, ESB_FRAME_BATCH, ESB_FRAME_BULK_DATA,
+                              ESB_FRAME_BULK_ACK};
+
+    for (int i = 0; i < ARRAY_SIZE(nested); i++) {
+        // A fragment carrying a complete fragment of another message
+        const uint8_t frag[] = {i, 0, 1, nested[i], i + 100, 0, 1, ESB_EVT_CHANNEL_ACTIVE, 40};
+
+        esb_frag_handle(&fake_dev, frag, sizeof(frag));
+        zassert_equal(fake_handled, 0, "frame 0x%02x dispatched", nested[i]);
+        zassert_equal(fake_data.frag.rx_len, 0);
+    }
+}
+
+ZTEST_SUITE(esb_frag, NULL, NULL, esb_frag_test_before, NULL, NULL);
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2025 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/ztest.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// A UART whose resume takes fake_resume_us, like one restarting its clocks
+
+static uint32_t fake_resume_us;
+
+static int fake_uart_pm_action(const struct device *dev, enum pm_device_action action) {
+    if (action == PM_DEVICE_ACTION_RESUME) {
+        k_busy_wait(fake_resume_us);
+    }
+    return 0;
+}
+
+static void fake_uart_irq_rx_enable(const struct device *dev) {}
+
+static void fake_uart_irq_tx_enable(const struct device *dev) {}
+
+static int fake_uart_irq_tx_complete(const struct device *dev) { return 1; }
+
+static const struct uart_driver_api fake_uart_api = {
+    .irq_rx_enable = fake_uart_irq_rx_enable,
+    .irq_tx_enable = fake_uart_irq_tx_enable,
+    .irq_tx_complete = fake_uart_irq_tx_complete,
+};
+
+PM_DEVICE_DEFINE(fake_uart, fake_uart_pm_action);
+DEVICE_DEFINE(fake_uart, "fake_uart", NULL, PM_DEVICE_GET(fake_uart), NULL, NULL, POST_KERNEL,
+              CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, &fake_uart_api);
+
+// Host-wake is wired but its GPIO never comes up, so nothing else holds the
+// UART in efficiency mode
+static const struct esb_transport_config fake_config = {
+    .uart = DEVICE_GET(fake_uart),
+    .has_host_wake = true,
+};
+static uint8_t fake_tx_queue[64];
+static struct esb_transport_data fake_data;
+static const struct device fake_dev = {
+    .name = "esb_fake",
+    .config = &fake_config,
+    .data = &fake_data,
+};
+
+// Fakes of the transport functions esb_power.c calls
+
+const struct device *esb_transport_get(int index) { return index == 0 ? &fake_dev : NULL; }
+
+const struct device *esb_transport_default(void) { return &fake_dev; }
+
+bool esb_transport_is_connected(const struct device *dev) { return false; }
+
+// Queues like the real one, which marks the TX reference used for threads
+int esb_transport_tx(const struct device *dev, const uint8_t *buf, size_t len,
+                     k_timeout_t timeout) {
+    k_spinlock_key_t key = k_spin_lock(&fake_data.tx_lock);
+    uint32_t put = ring_buf_put(&fake_data.tx_ring, buf, len);
+
+    fake_data.power.tx_used = true;
+    k_spin_unlock(&fake_data.tx_lock, key);
+
+    return put == len ? 0 : -EAGAIN;
+}
+
+size_t esb_transport_tx_pending(const struct device *dev) {
+    return ring_buf_size_get(&fake_data.tx_ring);
+}
+
+bool esb_hid_pending(const struct device *dev) { return false; }
+
+// Bulk data written but not yet acknowledged by BLESB
+static bool fake_bulk_busy;
+
+bool esb_bulk_busy(const struct device *dev) { return fake_bulk_busy; }
+
+void esb_hid_flush(const struct device *dev) {}
+
+// One pass of the UART TX ISR: a byte into the FIFO, or the queue found empty
+static void fake_uart_isr(void) {
+    uint8_t byte;
+
+    if (ring_buf_get(&fake_data.tx_ring, &byte, 1) == 0) {
+        esb_power_tx_idle(&fake_dev);
+    } else {
+        esb_power_note_resume_tx(&fake_dev);
+    }
+}
+
+static enum pm_device_state fake_uart_state(void) {
+    enum pm_device_state state;
+
+    zassert_equal(pm_device_state_get(DEVICE_GET(fake_uart), &state), 0);
+    return state;
+}
+
+// Wait out the delay before a released UART is suspended
+static void fake_uart_settle(void) {
+    k_sleep(K_MSEC(CONFIG_ZMK_ESB_UART_SUSPEND_DELAY_MS + 5));
+}
+
+static void esb_power_test_before(void *fixture) {
+    const struct device *uart = DEVICE_GET(fake_uart);
+
+    // Drop every reference left by the previous test
+    fake_resume_us = 0;
+    fake_bulk_busy = false;
+    pm_device_runtime_disable(uart);
+    pm_device_runtime_enable(uart);
+
+    memset(&fake_data, 0, sizeof(fake_data));
+    fake_data.dev = &fake_dev;
+    ring_buf_init(&fake_data.tx_ring, sizeof(fake_tx_queue), fake_tx_queue);
+    esb_power_init(&fake_dev);
+}
+
+static void esb_power_test_after(void *fixture) {
+    k_work_cancel_delayable(&fake_data.power.idle_work);
+    k_work_cancel_delayable(&fake_data.power.wake_work);
+    fake_uart_settle();
+}
+
+ZTEST(esb_power, test_idle_uart_suspended) {
+    zassert_equal(fake_uart_state(), PM_DEVICE_STATE_SUSPENDED);
+}
+
+ZTEST(esb_power, test_resume_to_first_byte) {
+    const uint8_t frame[] = {HID_PACKET_TYPE_KEYBOARD, 8, 0, 0, 4, 0, 0, 0, 0, 0};
+    struct zmk_esb_resume_stats stats;
+
+    fake_resume_us = 40;
+
+    esb_power_tx_get(&fake_dev);
+    zassert_equal(fake_uart_state(), PM_DEVICE_STATE_ACTIVE);
+    zassert_ok(esb_transport_tx(&fake_dev, frame, sizeof(frame), K_NO_WAIT));
+    fake_uart_isr();
+
+    zassert_ok(zmk_esb_get_resume_stats(&stats));
+    TC_PRINT("UART resume to first byte: %u us\n", stats.last_us);
+    zassert_equal(stats.resumes, 1);
+    zassert_true(stats.last_us >= fake_resume_us, "%u us", stats.last_us);
+    zassert_true(stats.last_us <= CONFIG_ZMK_ESB_UART_RESUME_BUDGET_US, "%u us", stats.last_us);
+    zassert_false(stats.pinned);
+
+    // Bytes after the first are not another resume
+    for (size_t i = 1; i < sizeof(frame); i++) {
+        fake_uart_isr();
+    }
+    zassert_ok(zmk_esb_get_resume_stats(&stats));
+    zassert_equal(stats.resumes, 1);
+
+    // Drained: the UART goes back to sleep
+    fake_uart_isr();
+    fake_uart_settle();
+    zassert_equal(fake_uart_state(), PM_DEVICE_STATE_SUSPENDED);
+}
+
+ZTEST(esb_power, test_resume_over_budget_pins) {
+    const uint8_t frame[] = {HID_PACKET_TYPE_CONSUMER, 2, 0xe9, 0};
+    struct zmk_esb_resume_stats stats;
+
+    fake_resume_us = 2 * CONFIG_ZMK_ESB_UART_RESUME_BUDGET_US;
+
+    esb_power_tx_get(&fake_dev);
+    zassert_ok(esb_transport_tx(&fake_dev, frame, sizeof(frame), K_NO_WAIT));
+    for (size_t i = 0; i <= sizeof(frame); i++) {
+        fake_uart_isr();
+    }
+
+    zassert_ok(zmk_esb_get_resume_stats(&stats));
+    TC_PRINT("UART resume to first byte: %u us\n", stats.last_us);
+    zassert_true(stats.last_us > CONFIG_ZMK_ESB_UART_RESUME_BUDGET_US, "%u us", stats.last_us);
+    zassert_true(stats.pinned);
+
+    // Too slow to resume again: kept powered even once drained
+    fake_uart_settle();
+    zassert_equal(fake_uart_state(), PM_DEVICE_STATE_ACTIVE);
+}
+
+ZTEST(esb_power, test_reference_kept_until_queued) {
+    const uint8_t frame[] = {HID_PACKET_TYPE_CONSUMER, 2, 0xe9, 0};
+
+    // The ISR finds the queue empty before the thread has queued its bytes
+    esb_power_tx_get(&fake_dev);
+    fake_uart_isr();
+    zassert_equal(pm_device_runtime_usage(DEVICE_GET(fake_uart)), 1);
+
+    zassert_ok(esb_transport_tx(&fake_dev, frame, sizeof(frame), K_NO_WAIT));
+    for (size_t i = 0; i <= sizeof(frame); i++) {
+        fake_uart_isr();
+    }
+    fake_uart_settle();
+    zassert_equal(fake_uart_state(), PM_DEVICE_STATE_SUSPENDED);
+}
+
+ZTEST(esb_power, test_reference_kept_for_bulk_ack) {
+    const uint8_t segment[] = {ESB_FRAME_BULK_DATA, 4, 0, 0, 0xaa, 0xbb};
+
+    fake_bulk_busy = true;
+    esb_power_tx_get(&fake_dev);
+    zassert_ok(esb_transport_tx(&fake_dev, segment, sizeof(segment), K_NO_WAIT));
+    for (size_t i = 0; i <= sizeof(segment); i++) {
+        fake_uart_isr();
+    }
+
+    // Drained, but the ACK may let more segments out from its ISR
+    fake_uart_settle();
+    zassert_equal(fake_uart_state(), PM_DEVICE_STATE_ACTIVE);
+
+    // Everything acknowledged
+    fake_bulk_busy = false;
+    esb_power_tx_idle(&fake_dev);
+    fake_uart_settle();
+    zassert_equal(fake_uart_state(), PM_DEVICE_STATE_SUSPENDED);
+}
+
+ZTEST_SUITE(esb_power, NULL, NULL, esb_power_test_before, esb_power_test_after, NULL);
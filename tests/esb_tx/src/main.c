@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2025 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/ztest.h>
+
+#include <zmk_feature_esb_transport/events/esb_tx_space_available.h>
+
+#include "esb_protocol.h"
+#include "esb_transport.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// One byte on the wire at 460800 baud, 10 bits a byte
+#define FAKE_BYTE_US 22
+// Mouse reports at 8 kHz
+#define FAKE_MOUSE_US 125
+// Time to put one full payload on the wire
+#define FAKE_PAYLOAD_US (ESB_PAYLOAD_LEGACY * FAKE_BYTE_US)
+// From a bulk segment leaving the UART to its ACK coming back over the radio
+#define FAKE_ACK_US 500
+
+static struct esb_frame fake_frames[16];
+static uint8_t fake_batch_buf[ESB_PAYLOAD_LEGACY];
+static const struct esb_transport_config fake_config = {
+    .max_payload = ESB_PAYLOAD_LEGACY,
+    .frames = fake_frames,
+    .frame_queue_depth = ARRAY_SIZE(fake_frames),
+    .batch_buf = fake_batch_buf,
+};
+static uint8_t fake_tx_queue[128];
+static struct esb_transport_data fake_data;
+
+DEVICE_DEFINE(esb_fake, "esb_fake", NULL, NULL, &fake_data, &fake_config, POST_KERNEL,
+              CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, NULL);
+
+static bool fake_power_hold;
+static bool fake_tx_ref;
+static size_t fake_tx_payloads;
+static size_t fake_unheld;
+
+// Reports as ZMK's HID module would hand them out
+static struct zmk_hid_keyboard_report fake_keyboard;
+static struct zmk_hid_consumer_report fake_consumer;
+static struct zmk_hid_mouse_report fake_mouse;
+
+// Keyboard press waiting to leave esb_hid_drain, and how long each took
+static bool fake_key_pending;
+static uint32_t fake_key_pressed;
+static uint32_t fake_key_max_us;
+static uint32_t fake_key_total_us;
+static uint32_t fake_key_count;
+
+// The fake UART: one byte leaves the TX queue every FAKE_BYTE_US, and each
+// payload is handed to the fake BLESB once its last byte is out
+static struct k_work_delayable fake_wire_work;
+static uint8_t fake_rx[ESB_PAYLOAD_LEGACY];
+static size_t fake_rx_len;
+
+// The fake BLESB end of the bulk channel: accepts segments in order, drops
+// every fake_drop_every-th one it is sent, and ACKs after FAKE_ACK_US
+static uint8_t fake_bulk_rx[4096];
+static size_t fake_bulk_rx_len;
+static uint16_t fake_bulk_next;
+static size_t fake_bulk_segments;
+static size_t fake_drop_every;
+static size_t fake_dropped;
+static struct k_work_delayable fake_ack_work;
+
+static void fake_ack_work_handler(struct k_work *work) {
+    struct esb_bulk_header ack = {
+        .seq = sys_cpu_to_le16(fake_bulk_next),
+    };
+
+    esb_bulk_handle(DEVICE_GET(esb_fake), ESB_FRAME_BULK_ACK, (const uint8_t *)&ack,
+                    sizeof(ack));
+}
+
+static void fake_blesb_receive(const uint8_t *payload, size_t len) {
+    const struct esb_bulk_header *bulk = (const void *)&payload[sizeof(struct hid_packet_header)];
+    size_t overhead = sizeof(struct hid_packet_header) + sizeof(*bulk);
+
+    if (payload[0] != ESB_FRAME_BULK_DATA) {
+        return;
+    }
+
+    if (fake_drop_every > 0 && ++fake_bulk_segments % fake_drop_every == 0) {
+        fake_dropped++;
+        return;
+    }
+
+    if (sys_le16_to_cpu(bulk->seq) == fake_bulk_next &&
+        fake_bulk_rx_len + len - overhead <= sizeof(fake_bulk_rx)) {
+        memcpy(&fake_bulk_rx[fake_bulk_rx_len], &payload[overhead], len - overhead);
+        fake_bulk_rx_len += len - overhead;
+        fake_bulk_next++;
+    }
+
+    k_work_schedule(&fake_ack_work, K_USEC(FAKE_ACK_US));
+}
+
+static void fake_wire_work_handler(struct k_work *work) {
+    uint8_t byte;
+
+    if (ring_buf_get(&fake_data.tx_ring, &byte, 1) == 1) {
+        fake_rx[fake_rx_len++] = byte;
+        if (fake_rx_len >= sizeof(struct hid_packet_header) &&
+            fake_rx_len == sizeof(struct hid_packet_header) + fake_rx[1]) {
+            fake_blesb_receive(fake_rx, fake_rx_len);
+            fake_rx_len = 0;
+        }
+        // The real ISR calls this after each byte it moves to the FIFO
+        esb_hid_tx_ready(DEVICE_GET(esb_fake));
+    }
+
+    if (ring_buf_is_empty(&fake_data.tx_ring)) {
+        esb_power_tx_idle(DEVICE_GET(esb_fake));
+    } else {
+        k_work_schedule(&fake_wire_work, K_USEC(FAKE_BYTE_US));
+    }
+}
+
+static bool fake_has_keyboard(const uint8_t *buf, size_t len) {
+    if (buf[0] != ESB_FRAME_BATCH) {
+        return buf[0] == HID_PACKET_TYPE_KEYBOARD;
+    }
+
+    for (size_t off = sizeof(struct hid_packet_header); off < len;
+         off += sizeof(struct hid_packet_header) + buf[off + 1]) {
+        if (buf[off] == HID_PACKET_TYPE_KEYBOARD) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fakes of the transport functions esb_hid.c and esb_bulk.c call
+
+const struct device *esb_transport_get(int index) {
+    return index == 0 ? DEVICE_GET(esb_fake) : NULL;
+}
+
+const struct device *esb_transport_default(void) { return DEVICE_GET(esb_fake); }
+
+const struct device *esb_transport_pointing(void) { return DEVICE_GET(esb_fake); }
+
+bool esb_transport_is_connected(const struct device *dev) { return true; }
+
+bool zmk_esb_active_profile_is_connected(void) { return true; }
+
+int esb_transport_tx(const struct device *dev, const uint8_t *buf, size_t len,
+                     k_timeout_t timeout) {
+    if (ring_buf_space_get(&fake_data.tx_ring) < len) {
+        return -EAGAIN;
+    }
+
+    if (fake_key_pending && fake_has_keyboard(buf, len)) {
+        uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - fake_key_pressed);
+
+        fake_key_pending = false;
+        fake_key_max_us = MAX(fake_key_max_us, us);
+        fake_key_total_us += us;
+        fake_key_count++;
+    }
+
+    ring_buf_put(&fake_data.tx_ring, buf, len);
+    fake_tx_payloads++;
+    if (!fake_tx_ref) {
+        fake_unheld++;
+    }
+    if (!k_work_delayable_is_pending(&fake_wire_work)) {
+        k_work_schedule(&fake_wire_work, K_USEC(FAKE_BYTE_US));
+    }
+    return 0;
+}
+
+size_t esb_transport_tx_pending(const struct device *dev) {
+    return ring_buf_size_get(&fake_data.tx_ring);
+}
+
+int esb_transport_send_ctrl(const struct device *dev, uint8_t type, const void *payload,
+                            size_t len, k_timeout_t timeout) {
+    return 0;
+}
+
+void esb_power_activity(const struct device *dev, bool report) { fake_tx_ref = true; }
+
+// Releases the UART on the same terms as the real one
+void esb_power_tx_idle(const struct device *dev) {
+    if (!esb_hid_pending(dev) && !esb_bulk_busy(dev) && ring_buf_is_empty(&fake_data.tx_ring)) {
+        fake_tx_ref = false;
+    }
+}
+
+// BLESB asleep: nothing may go out until it wakes
+bool esb_power_hold(const struct device *dev) { return fake_power_hold; }
+
+void esb_power_note_tx(const struct device *dev) {}
+
+int esb_rate_mouse_defer(const struct device *dev, const struct zmk_hid_mouse_report *report,
+                         uint32_t stamp) {
+    return 0;
+}
+
+void esb_rate_mouse_merge(struct zmk_hid_mouse_report *acc,
+                          const struct zmk_hid_mouse_report *report) {
+    acc->body.d_x += report->body.d_x;
+    acc->body.d_y += report->body.d_y;
+    acc->body.d_scroll_y += report->body.d_scroll_y;
+    acc->body.d_scroll_x += report->body.d_scroll_x;
+}
+
+uint8_t esb_frag_next_id(const struct device *dev) { return 0; }
+
+int esb_frag_count(const struct device *dev, size_t payload_len) { return 1; }
+
+int esb_frag_build(const struct device *dev, uint8_t *out, uint8_t msg_id, uint8_t index,
+                   uint8_t type, const uint8_t *payload, size_t len) {
+    return -ENOTSUP;
+}
+
+struct zmk_hid_keyboard_report *zmk_hid_get_keyboard_report(void) { return &fake_keyboard; }
+
+struct zmk_hid_consumer_report *zmk_hid_get_consumer_report(void) { return &fake_consumer; }
+
+struct zmk_hid_mouse_report *zmk_hid_get_mouse_report(void) { return &fake_mouse; }
+
+// Like ZMK's endpoints: a refused keyboard report is sent again once there is room
+int raise_zmk_esb_tx_space_available(struct zmk_esb_tx_space_available event) {
+    if (event.report_types & BIT(HID_PACKET_TYPE_KEYBOARD)) {
+        zmk_esb_hid_send_keyboard_report();
+    }
+    return 0;
+}
+
+static void esb_tx_test_before(void *fixture) {
+    memset(&fake_data, 0, sizeof(fake_data));
+    fake_data.dev = DEVICE_GET(esb_fake);
+    fake_data.max_payload = ESB_PAYLOAD_LEGACY;
+    fake_data.caps = ESB_CAPS_BATCH;
+    ring_buf_init(&fake_data.tx_ring, sizeof(fake_tx_queue), fake_tx_queue);
+    esb_hid_queue_init(DEVICE_GET(esb_fake));
+    esb_bulk_init(DEVICE_GET(esb_fake));
+    k_work_init_delayable(&fake_wire_work, fake_wire_work_handler);
+    k_work_init_delayable(&fake_ack_work, fake_ack_work_handler);
+
+    memset(&fake_keyboard, 0, sizeof(fake_keyboard));
+    memset(&fake_mouse, 0, sizeof(fake_mouse));
+    fake_power_hold = false;
+    fake_tx_ref = false;
+    fake_tx_payloads = 0;
+    fake_unheld = 0;
+    fake_bulk_rx_len = 0;
+    fake_bulk_next = 0;
+    fake_bulk_segments = 0;
+    fake_drop_every = 0;
+    fake_dropped = 0;
+    fake_rx_len = 0;
+    fake_key_pending = false;
+    fake_key_max_us = 0;
+    fake_key_total_us = 0;
+    fake_key_count = 0;
+}
+
+static void esb_tx_test_after(void *fixture) {
+    k_work_cancel_delayable(&fake_wire_work);
+    k_work_cancel_delayable(&fake_ack_work);
+    k_work_cancel_delayable(&fake_data.bulk.retransmit_work);
+    k_work_cancel(&fake_data.bulk.rx_work);
+    k_work_cancel(&fake_data.hid.flush_work);
+    k_work_cancel(&fake_data.hid.space_work);
+}
+
+ZTEST(esb_tx, test_keyboard_under_mouse_flood) {
+    // One second of motion, with a key pressed or released every 5 ms
+    for (int tick = 0; tick < 1000000 / FAKE_MOUSE_US; tick++) {
+        fake_mouse.body.d_x = 1;
+        zmk_esb_hid_send_mouse_report();
+
+        if (tick % 40 == 20) {
+            zassert_false(fake_key_pending, "key still queued after %u us",
+                          k_cyc_to_us_floor32(k_cycle_get_32() - fake_key_pressed));
+            fake_keyboard.body.keys[0] = fake_keyboard.body.keys[0] ? 0 : 0x04;
+            fake_key_pressed = k_cycle_get_32();
+            fake_key_pending = true;
+            zmk_esb_hid_send_keyboard_report();
+        }
+
+        k_sleep(K_USEC(FAKE_MOUSE_US));
+    }
+
+    zassert_equal(fake_key_count, 200);
+    TC_PRINT("Keyboard press to UART queue under 8 kHz motion: avg %u us, max %u us\n",
+             fake_key_total_us / fake_key_count, fake_key_max_us);
+
+    // A keystroke waits behind at most the payload on the wire and the one
+    // queued after it
+    zassert_true(fake_key_max_us <= 2 * FAKE_PAYLOAD_US, "%u us", fake_key_max_us);
+}
+
+ZTEST(esb_tx, test_bulk_waits_for_wake) {
+    uint8_t buf[100];
+
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = i;
+    }
+
+    fake_power_hold = true;
+    zassert_equal(zmk_esb_bulk_write(buf, sizeof(buf), K_NO_WAIT), sizeof(buf));
+    k_sleep(K_MSEC(1));
+    zassert_equal(fake_tx_payloads, 0);
+
+    // BLESB awake: the wake work flushes what was held
+    fake_power_hold = false;
+    esb_hid_flush(DEVICE_GET(esb_fake));
+    zassert_true(fake_tx_payloads > 0);
+}
+
+ZTEST(esb_tx, test_duplicate_counts_once_sent) {
+    struct zmk_esb_hid_stats stats;
+
+    fake_keyboard.body.keys[0] = 0x04;
+
+    // Still queued while BLESB wakes: not yet sent, so not yet a duplicate
+    fake_power_hold = true;
+    zassert_ok(zmk_esb_hid_send_keyboard_report());
+    zassert_ok(zmk_esb_hid_send_keyboard_report());
+    zassert_ok(zmk_esb_hid_get_stats(&stats));
+    zassert_equal(stats.suppressed, 0);
+
+    fake_power_hold = false;
+    esb_hid_flush(DEVICE_GET(esb_fake));
+    zassert_ok(zmk_esb_hid_send_keyboard_report());
+    zassert_ok(zmk_esb_hid_get_stats(&stats));
+    zassert_equal(stats.suppressed, 1);
+
+    // Repeated once the last copy is old enough
+    k_sleep(K_MSEC(CONFIG_ZMK_ESB_DUPLICATE_REFRESH_MS));
+    size_t sent = fake_tx_payloads;
+    zassert_ok(zmk_esb_hid_send_keyboard_report());
+    zassert_equal(fake_tx_payloads, sent + 1);
+}
+
+// Write a pattern through the bulk channel and wait for BLESB to acknowledge
+// all of it; returns the throughput in bytes per second
+static uint32_t esb_tx_test_bulk(size_t total) {
+    static uint8_t buf[sizeof(fake_bulk_rx)];
+    uint32_t start = k_cycle_get_32();
+
+    for (size_t i = 0; i < total; i++) {
+        buf[i] = i * 7 + (i >> 8);
+    }
+
+    zassert_equal(zmk_esb_bulk_write(buf, total, K_FOREVER), total);
+    for (int ms = 0; ms < 10000 && esb_bulk_busy(DEVICE_GET(esb_fake)); ms++) {
+        k_sleep(K_MSEC(1));
+    }
+    zassert_false(esb_bulk_busy(DEVICE_GET(esb_fake)), "unacknowledged after 10 s");
+
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+    // Delivered in order, each byte once
+    zassert_equal(fake_bulk_rx_len, total);
+    zassert_mem_equal(fake_bulk_rx, buf, total);
+
+    // Nothing was queued without holding the UART, and it was let go after
+    zassert_equal(fake_unheld, 0);
+    zassert_false(fake_tx_ref);
+
+    return (uint32_t)((uint64_t)total * 1000000 / us);
+}
+
+ZTEST(esb_tx, test_bulk_throughput) {
+    struct zmk_esb_bulk_stats stats;
+    uint32_t rate = esb_tx_test_bulk(sizeof(fake_bulk_rx));
+
+    TC_PRINT("Bulk throughput: %u.%02u KB/s\n", rate / 1000, rate % 1000 / 10);
+
+    zassert_ok(zmk_esb_bulk_get_stats(&stats));
+    zassert_equal(stats.tx_bytes, sizeof(fake_bulk_rx));
+    zassert_equal(stats.retransmits, 0);
+}
+
+ZTEST(esb_tx, test_bulk_throughput_with_loss) {
+    struct zmk_esb_bulk_stats stats;
+
+    fake_drop_every = 20;
+    uint32_t rate = esb_tx_test_bulk(sizeof(fake_bulk_rx));
+
+    TC_PRINT("Bulk throughput, 1 in %zu segments lost: %u.%02u KB/s, %u retransmits\n",
+             fake_drop_every, rate / 1000, rate % 1000 / 10, fake_data.bulk.stats.retransmits);
+
+    zassert_ok(zmk_esb_bulk_get_stats(&stats));
+    zassert_equal(stats.tx_bytes, sizeof(fake_bulk_rx));
+    zassert_true(fake_dropped > 0);
+    // Go-back-N: one retransmit recovers each loss, and at most every loss
+    zassert_between_inclusive(stats.retransmits, 1, fake_dropped);
+}
+
+ZTEST_SUITE(esb_tx, NULL, NULL, esb_tx_test_before, esb_tx_test_after, NULL);
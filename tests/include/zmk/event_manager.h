@@ -0,0 +1,23 @@
+#pragma once
+
+// Stand-in for ZMK's event manager: raised events go straight to a raise_*()
+// the test defines, and no event ever reaches a listener
+
+#include <zephyr/kernel.h>
+
+typedef struct zmk_event {
+    const char *name;
+} zmk_event_t;
+
+#define ZMK_EV_EVENT_BUBBLE 0
+
+#define ZMK_EVENT_DECLARE(event_type)                                                              \
+    int raise_##event_type(struct event_type event);                                              \
+    static inline struct event_type *as_##event_type(const zmk_event_t *eh) { return NULL; }
+
+#define ZMK_EVENT_IMPL(event_type)
+
+#define ZMK_LISTENER(mod, cb)                                                                      \
+    static inline int mod##_listener_unused(const zmk_event_t *eh) { return cb(eh); }
+
+#define ZMK_SUBSCRIPTION(mod, ev_type)
@@ -0,0 +1,44 @@
+#pragma once
+
+// Stand-in for ZMK's hid.h with only the report layouts the transport sizes
+// its frames by
+
+#include <zephyr/kernel.h>
+
+struct zmk_hid_keyboard_report_body {
+    uint8_t modifiers;
+    uint8_t _reserved;
+    uint8_t keys[6];
+} __packed;
+
+struct zmk_hid_keyboard_report {
+    uint8_t report_id;
+    struct zmk_hid_keyboard_report_body body;
+} __packed;
+
+struct zmk_hid_consumer_report_body {
+    uint16_t keys[6];
+} __packed;
+
+struct zmk_hid_consumer_report {
+    uint8_t report_id;
+    struct zmk_hid_consumer_report_body body;
+} __packed;
+
+struct zmk_hid_mouse_report_body {
+    uint8_t buttons;
+    int16_t d_x;
+    int16_t d_y;
+    int16_t d_scroll_y;
+    int16_t d_scroll_x;
+} __packed;
+
+struct zmk_hid_mouse_report {
+    uint8_t report_id;
+    struct zmk_hid_mouse_report_body body;
+} __packed;
+
+// Defined by the suites that send reports through the public API
+struct zmk_hid_keyboard_report *zmk_hid_get_keyboard_report(void);
+struct zmk_hid_consumer_report *zmk_hid_get_consumer_report(void);
+struct zmk_hid_mouse_report *zmk_hid_get_mouse_report(void);